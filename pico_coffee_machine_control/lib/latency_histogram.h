@@ -0,0 +1,68 @@
+#ifndef LATENCY_HISTOGRAM
+#define LATENCY_HISTOGRAM
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/structs/systick.h"
+
+/*Latency instrumentation, enabled by CMake option LATENCY_INSTRUMENTATION (otherwise macros compile to nothing).
+Interrupt handlers are measured by SysTick of the executing core in CPU cycles (counter wraps after 2^24 cycles),
+Modbus response latency is measured by timer in us. Every site has histogram with power of two buckets:
+bucket 0 counts zero values, bucket n counts values from 2^(n-1) to 2^n - 1, the last bucket counts all larger values.
+*/
+
+#define LATENCY_SITE_DMA_IRQ0 0         //dma_irq0_handler (cycles)
+#define LATENCY_SITE_GPIO_IRQ 1         //gpio_irq_handler (cycles)
+#define LATENCY_SITE_PIO0_IRQ0 2        //pio0_irq0_handler (cycles)
+#define LATENCY_SITE_ALARM_CALLBACK 3   //Alarm callbacks of core0 (cycles)
+#define LATENCY_SITE_MODBUS_RESPONSE 4  //End of request frame to the first byte of response (us)
+#define LATENCY_SITE_NUM 5
+#define LATENCY_BUCKET_NUM 16
+#define SYSTICK_MAX_VALUE 0xFFFFFF
+#define SYSTICK_CSR_ENABLE_CPU_CLOCK 0x5 //Counter enabled, clocked by processor, no interrupt
+
+/**
+ * @brief Histogram of durations measured at one site
+ */
+typedef struct {
+    uint32_t buckets[LATENCY_BUCKET_NUM];
+    uint32_t max;
+} latency_histogram;
+
+#ifdef LATENCY_INSTRUMENTATION
+#define LATENCY_INIT() init_latency_instrumentation()
+//SysTick counts down
+#define LATENCY_START(name) uint32_t name = systick_hw->cvr
+#define LATENCY_END(site, name) record_latency(site, (name - systick_hw->cvr) & SYSTICK_MAX_VALUE)
+#define LATENCY_RECORD(site, value) record_latency(site, value)
+#else
+#define LATENCY_INIT()
+#define LATENCY_START(name)
+#define LATENCY_END(site, name)
+#define LATENCY_RECORD(site, value)
+#endif
+
+/**
+ * @brief Starts SysTick of calling core, must be called by both cores.
+ * 
+ * Lock of histograms is claimed by the first call.
+ */
+void init_latency_instrumentation();
+
+/**
+ * @brief Adds value into histogram of site.
+ * 
+ * @param site Index of measured site
+ * @param value Duration (in units of site)
+ */
+void record_latency(int site, uint32_t value);
+
+/**
+ * @brief Copies histograms of all sites.
+ * 
+ * @param histograms Output buffer (LATENCY_SITE_NUM histograms)
+ * @param reset If true, histograms are cleared after copying
+ */
+void read_latency_histograms(latency_histogram* histograms, bool reset);
+
+#endif
@@ -9,6 +9,10 @@
 #include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "lib/registers.h"
+#include "lib/screen_decoder.h"
+#include "lib/screen_classifier.h"
+#include "lib/screen_snapshot.h"
+#include "lib/latency_histogram.h"
 
 //UART1 variables
 /*#define DEBUG_UART uart0
@@ -17,11 +21,14 @@
 #define DEBUG_UART_RX_PIN 1*/
 
 //SPI variables
-#define SPI_TRANSMISSION_TIME_US 7000
 #define SPI_RECV_WATCHDOG_TIMEOUT_US 3*102000 //Duration of 3 SPI transmissions + delay
 #define SPI_PIO pio0
 #define SPI_SM 0
+#define SPI_FRAME_SM 2 //Detects frame boundaries on CS pin
 #define SPI_CLKDIV 5
+#define SPI_FRAME_BUFFER_NUM 3 //DMA target, newest complete frame and frame being parsed
+#define SPI_NO_FRAME -1
+#define SPI_FRAME_HASH_SEED 0xFFFFFFFF //Initial value of DMA sniffer (CRC32)
 
 //Register variables
 #define REG_TRANSMISSION_TIME_US 45
@@ -42,17 +49,41 @@
 #define SCREEN_RED_PIN 21
 #define SCREEN_WHITE_PIN 22
 #define STANDBY_LED_TIMEOUT_US 3500000
+#define WATCHDOG_SERVICE_PERIOD_US 5000 //Period of checking SPI, REG and standby timeouts
+
+//Debounced status inputs (index into status_inputs)
+#define STATUS_INPUT_POWER_5V 0
+#define STATUS_INPUT_SCREEN_RED 1
+#define STATUS_INPUT_SCREEN_WHITE 2
+#define STATUS_INPUT_POWER_BUTTON 3
+#define STATUS_INPUT_NUM 4
+#define POWER_5V_DEBOUNCE_US 5000
+#define SCREEN_DEBOUNCE_US 2000
+#define POWER_BUTTON_DEBOUNCE_US 10000
 #define PUSH_BUTTON_DURATION 200000
 
 
 //Public registers
-volatile spi_registers spi_parsed_data = {0};
-volatile bool spi_lock_data = false;
 volatile event_register input_data = {0};
 volatile command_register command_data = {0};
-volatile bool command_update_request = false;
+volatile uint16_t command_completed_sequence = 0; //Sequence of the last command executed by core0
 volatile bool unread_input_data = false;
-volatile bool unread_screen_data = false;
+volatile screen_snapshot screen_snapshots[SCREEN_SNAPSHOT_NUM] = {{.classification = {.screen_id = SCREEN_NO_MATCH}}};
+volatile int screen_latest_snapshot = 0;    //Newest published snapshot
+volatile int screen_pinned_snapshot = 0;    //Snapshot read by host (set by core1)
+volatile screen_history_entry screen_history[SCREEN_HISTORY_SLOT_NUM] = {0};
+volatile uint32_t screen_history_count = 0; //Incremented after entry is written
+volatile input_event input_event_log[INPUT_EVENT_SLOT_NUM] = {0};
+volatile uint32_t input_event_count = 0; //Incremented after entry is written
+spin_lock_t* input_data_lock = NULL;     //input_data is written by both cores, every change is logged under lock
+volatile macro_step macro_steps[MACRO_MAX_STEP_NUM] = {0};    //Written by core1 while macro is not running
+volatile uint16_t macro_step_num = 0;
+volatile uint16_t macro_state = MACRO_IDLE;
+volatile uint16_t macro_current_step = 0;
+volatile bool macro_abort_request = false;
+volatile bool core0_events[EVENT_NUM] = {0};    //Set by post_event(), cleared by main loop before handling
+spin_lock_t* capture_statistics_lock = NULL;  //Statistics are reset by core1 when read
+volatile capture_statistics capture_stats = {0};
 
 //Linked from another header
 void communication_loop();
@@ -1,21 +1,39 @@
 #include "lib/registers.h"
-
-/*Modbus is implemented as non-inverted UART with even parity and 1 stop bit. Only
-ReadInputRegisters, ReadHoldingRegisters and WriteSingleRegister functions are implemented, so the
-standard request packet should consist of 6 bytes + CRC (2 bytes). Protocol data, such as 
+#include "lib/screen_classifier.h"
+#include "lib/screen_compression.h"
+#include "lib/screen_snapshot.h"
+#include "lib/modbus_crc.h"
+#include "lib/latency_histogram.h"
+#ifdef MODBUS_USB_TRANSPORT
+#include "lib/usb_transport.h"
+#endif
+
+/*Modbus is implemented as non-inverted UART with even parity and 1 stop bit. 
+ReadInputRegisters, ReadHoldingRegisters and WriteSingleRegister requests consist of 6 bytes + CRC (2 bytes),
+WriteMultipleRegisters and ReadWriteMultipleRegisters requests have variable length. Protocol data, such as 
 number of registers and first register address are transmitted in big endian, payload (and CRC)
 is transmitted "as is" (little endian).
+
+ReadWriteMultipleRegisters writes holding registers and then reads INPUT registers (not holding
+registers as defined by standard), so command and its status read-back take one transaction. 
+Commands are executed by core0, read part is served after core0 completes the written command.
 */
 
 //UART0 variables
 #define MODBUS_UART uart0
-#define MODBUS_UART_BAUD_RATE 115200
+#define MODBUS_UART_IRQ UART0_IRQ
+#define MODBUS_UART_BAUD_RATE 115200 //Default baud rate, can be changed by host
+#define MODBUS_MIN_BAUD_RATE 9600
+#define MODBUS_MAX_BAUD_RATE 3000000
+#define BAUD_RATE_REGISTER_UNIT 100
+#define BAUD_RATE_CONFIRM_TIMEOUT_US 1000000 //Host must send valid request at new baud rate, otherwise it is reverted (BAUD_RATE_CONFIRM_TIMEOUT_MS of host)
+#define UART_FIFO_BAUD_RATE 1000000 //Above this rate, characters are received through FIFO
 #define MODBUS_UART_TX_PIN 0
 #define MODBUS_UART_RX_PIN 1
 #define UART_BIT_NUMBER 8
 #define UART_PARITY_BITS 1
 #define UART_STOP_BITS 1
-#define UART_RX_BUFFER_SIZE 128
+#define UART_RX_BUFFER_SIZE 256 //Maximal length of ModbusRTU frame
 
 //ModbusRTU variables
 #define MY_ADDRESS 2
@@ -24,46 +42,170 @@ is transmitted "as is" (little endian).
 #define CRC_LEN 2
 #define SINGLE_READ_RESPONSE_LEN 5
 #define MAX_RESPONSE_LENGTH 256
-#define WAIT_FOR_BYTES 2
+#define MAX_READ_REGISTER_NUM 125 //Limit of ModbusRTU protocol
 
 #define BITS_PER_BYTE (1 + UART_BIT_NUMBER + UART_PARITY_BITS + UART_STOP_BITS) //1 for start bit
-#define MAX_DELAY_US (1000000 / MODBUS_UART_BAUD_RATE * BITS_PER_BYTE * WAIT_FOR_BYTES)
-#define SPI_REGISTERS_READ_TIMEOUT_US 200000
+//Frame timing (t1.5 and t3.5 silent intervals), fixed values are required above 19200 baud
+#define MODBUS_FIXED_TIMING_BAUD_RATE 19200
+#define MODBUS_FIXED_T15_US 750
+#define MODBUS_FIXED_T35_US 1750
+#define MODBUS_RX_FRAME_NUM 2 //Frame being received and frame waiting for processing
+#define MODBUS_NO_FRAME -1
+#define MODBUS_TX_BUFFER_NUM 2 //Response being sent and response waiting for transmission
 
 #define FC_READ_HOLDING_REGISTERS 3
 #define FC_READ_INPUT_REGISTERS 4
 #define FC_WRITE_SINGLE_REGISTER 6
-//#define FC_WRITE_MULTIPLE_REGISTERS 16
+#define FC_WRITE_MULTIPLE_REGISTERS 16
+#define FC_READ_WRITE_MULTIPLE_REGISTERS 23
+#define WRITE_MULTIPLE_REQUEST_BASE_LENGTH 7        //Values follow
+#define READ_WRITE_MULTIPLE_REQUEST_BASE_LENGTH 11  //Values follow
+#define MAX_WRITE_REGISTER_NUM 123 //Limit of ModbusRTU protocol
+#define MAX_READ_WRITE_REGISTER_NUM 121 //Limit of ModbusRTU protocol (write part of ReadWriteMultipleRegisters)
 
 #define EX_ILLEGAL_FUNCTION 1
 #define EX_ILLEGAL_ADDRESS 2
-//#define EX_SERVER_BUSY 6
+#define EX_ILLEGAL_VALUE 3
+#define EX_SERVER_BUSY 6
 
 #define INPUT_REGISTER_ADDRESS 0000
+#define SCREEN_CHANGED_PAGES_REGISTER_ADDRESS 0001
+#define SCREEN_FRAME_HASH_REGISTER_ADDRESS 0002 //CRC32 of screen frame, high word first
+#define SCREEN_ID_REGISTER_ADDRESS 0004 //Index of recognized screen template
+#define SCREEN_CONFIDENCE_REGISTER_ADDRESS 0005
+#define SCREEN_MATCH_BITMAP_REGISTER_ADDRESS 0006 //Templates 0-15 in first register
+#define SCREEN_GENERATION_REGISTER_ADDRESS (SCREEN_MATCH_BITMAP_REGISTER_ADDRESS + SCREEN_MATCH_BITMAP_REGISTER_NUM) //High word first
+#define COMMAND_ISSUED_SEQUENCE_REGISTER_ADDRESS (SCREEN_GENERATION_REGISTER_ADDRESS + 2) //Sequence of the last written command
+#define COMMAND_COMPLETED_SEQUENCE_REGISTER_ADDRESS (SCREEN_GENERATION_REGISTER_ADDRESS + 3) //Sequence of the last executed command
+#define MACRO_STATE_REGISTER_ADDRESS (SCREEN_GENERATION_REGISTER_ADDRESS + 4)
+#define MACRO_CURRENT_STEP_REGISTER_ADDRESS (SCREEN_GENERATION_REGISTER_ADDRESS + 5) //Failed step if macro failed
+#define STATUS_REGISTER_NUM (12 + SCREEN_MATCH_BITMAP_REGISTER_NUM)
 #define HOLDING_REGISTER_ADDRESS 0000
+#define SCREEN_ACK_REGISTER_ADDRESS 0001 //Tag of compressed screen received by host (0 resets base)
+#define BAUD_RATE_REGISTER_ADDRESS 0002 //Baud rate in units of BAUD_RATE_REGISTER_UNIT
+#define HOLDING_REGISTER_NUM 3
+
+/*Button macro, every step takes MACRO_STEP_REGISTER_NUM registers (see macro_step). Writing number of steps
+into control register starts the macro (0 aborts running one), so steps and control register can be written 
+in one request. Steps can't be written while macro is running. Progress is reported in status registers.
+*/
+#define MACRO_STEP_REGISTER_ADDRESS 100
+#define MACRO_CONTROL_REGISTER_ADDRESS (MACRO_STEP_REGISTER_ADDRESS + MACRO_MAX_STEP_NUM * MACRO_STEP_REGISTER_NUM)
+#define MACRO_REGISTER_NUM (MACRO_MAX_STEP_NUM * MACRO_STEP_REGISTER_NUM + 1)
 
+/*Screen data are read from pinned snapshot, which is replaced by the latest one when status is read
+from INPUT_REGISTER_ADDRESS or group G1 is read. Pinned snapshot is never modified, so all screen
+reads between two pins come from the same frame (its generation is in status registers).
+*/
 #define SPI_INPUT_REGISTER_ADDRESS_G1 1000
 #define SPI_INPUT_REGISTER_ADDRESS_G2 2000
 #define SPI_INPUT_REGISTER_ADDRESS_G3 3000
 #define SPI_INPUT_REGISTER_ADDRESS_G4 4000
 #define SPI_INPUT_REGISTER_ADDRESS_G5 5000
 
+/*Decoded screen (1024 bytes of pixels), page n starts at SCREEN_PAGE_REGISTER_ADDRESS + n * SCREEN_PAGE_REGISTER_NUM.
+Any window of up to MAX_READ_REGISTER_NUM registers can be read, pages read completely are marked as read by host.
+*/
+#define SCREEN_PAGE_REGISTER_ADDRESS 6000
+#define SCREEN_REGISTER_NUM (SCREEN_PAGE_NUM * SCREEN_PAGE_REGISTER_NUM)
+
+/*Raw SPI frame as one flat range (same byte order as register groups), any window of
+up to MAX_READ_REGISTER_NUM registers can be read. Position of pages in raw frame is not fixed,
+so reading from the first register marks all pages as read by host (as reading of group G1 does).
+*/
+#define SPI_RAW_REGISTER_ADDRESS 10000
+#define SPI_RAW_REGISTER_NUM ((SPI_BYTE_NUM + 1) / 2)
+
+/*Compressed screen, reading of the first register encodes screen of pinned snapshot. Block starts with
+header: screen tag, tag of base screen, length of payload (in bytes) and CRC of decoded screen.
+Payload follows (see screen_compression.h), registers past the payload are undefined.
+*/
+#define SCREEN_COMPRESSED_REGISTER_ADDRESS 7000
+#define SCREEN_COMPRESSED_HEADER_REGISTER_NUM 4
+#define SCREEN_COMPRESSED_REGISTER_NUM (SCREEN_COMPRESSED_HEADER_REGISTER_NUM + (SCREEN_COMPRESSED_MAX_LEN + 1) / 2)
+
+/*History of distinct screens, newest first. Block starts with number of recorded screens,
+every entry consists of sequence, screen ID, frame hash and capture timestamp in us (high words first).
+Sequence of unused entries is 0.
+*/
+#define SCREEN_HISTORY_REGISTER_ADDRESS 8000
+#define SCREEN_HISTORY_ENTRY_REGISTER_NUM 6
+#define SCREEN_HISTORY_REGISTER_NUM (1 + SCREEN_HISTORY_LEN * SCREEN_HISTORY_ENTRY_REGISTER_NUM)
+
+/*Log of input register changes, newest first. Change is recorded where the register is written (both cores,
+under lock), so no transition is merged with another one. Block starts with number of recorded changes,
+every entry consists of sequence, new value of input register and timestamp in us (high word first).
+Timestamp of debounced status inputs is their first edge, so it can be older than timestamp of previous entry.
+Sequence of unused entries is 0. Host reads the whole block and takes entries with sequence newer
+than the last one it has seen, gap in sequences means that log overflowed between reads.
+*/
+#define INPUT_EVENT_LOG_REGISTER_ADDRESS 8500
+#define INPUT_EVENT_ENTRY_REGISTER_NUM 4
+#define INPUT_EVENT_LOG_REGISTER_NUM (1 + INPUT_EVENT_LOG_LEN * INPUT_EVENT_ENTRY_REGISTER_NUM)
+
+/*Statistics of SPI capture, every value takes 2 registers (high word first). Values are
+received, dropped, overwritten, identical, malformed and published frames, watchdog timeouts,
+debounce alarm failures, then min/avg/max of frame interval, publish latency and ISR duration (in us).
+Reading from the first register resets statistics.
+*/
+#define CAPTURE_STATISTICS_REGISTER_ADDRESS 9000
+#define CAPTURE_STATISTICS_VALUE_NUM 17
+#define CAPTURE_STATISTICS_REGISTER_NUM (CAPTURE_STATISTICS_VALUE_NUM * 2)
+
+/*Latency histograms (only with LATENCY_INSTRUMENTATION, see latency_histogram.h). Every site takes
+LATENCY_SITE_REGISTER_NUM registers: counts of buckets followed by maximal value, every value takes 
+2 registers (high word first). Any window of up to MAX_READ_REGISTER_NUM registers can be read,
+reading from the first register resets histograms.
+*/
+#define LATENCY_HISTOGRAM_REGISTER_ADDRESS 9100
+#define LATENCY_SITE_REGISTER_NUM ((LATENCY_BUCKET_NUM + 1) * 2)
+#define LATENCY_HISTOGRAM_REGISTER_NUM (LATENCY_SITE_NUM * LATENCY_SITE_REGISTER_NUM)
+
+#define COMMAND_FIFO_TIMEOUT_US 1000 //Core0 empties FIFO in interrupt, so it is full only if core0 is stuck
+#define COMMAND_COMPLETE_TIMEOUT_US 1000 //Max wait of ReadWriteMultipleRegisters for command execution by core0
+
 #define ONBOARD_LED_TIME_US 200000
 #define ONBOARD_LED_PIN 25
 
 #define MAX_TIMERS_NUM 2
 
 //Public registers
-extern volatile spi_registers spi_parsed_data;
-extern volatile bool spi_lock_data;
 extern volatile event_register input_data;
 extern volatile command_register command_data;
-extern volatile bool command_update_request;
+extern volatile uint16_t command_completed_sequence;
+extern volatile macro_step macro_steps[MACRO_MAX_STEP_NUM];
+extern volatile uint16_t macro_step_num;
+extern volatile uint16_t macro_state;
+extern volatile uint16_t macro_current_step;
+extern volatile bool macro_abort_request;
 extern volatile bool unread_input_data;
-extern volatile bool unread_screen_data;
+extern volatile screen_snapshot screen_snapshots[SCREEN_SNAPSHOT_NUM];
+extern volatile int screen_latest_snapshot;
+extern volatile int screen_pinned_snapshot;
+extern volatile screen_history_entry screen_history[SCREEN_HISTORY_SLOT_NUM];
+extern volatile uint32_t screen_history_count;
+extern volatile input_event input_event_log[INPUT_EVENT_SLOT_NUM];
+extern volatile uint32_t input_event_count;
+
+//Linked from another header
+void read_capture_statistics(uint32_t* values, bool reset);
+bool start_macro(uint16_t step_num);
+void post_event(int event);
+uint32_t lock_input_data();
+void unlock_input_data(uint32_t interrupts, uint32_t timestamp_us);
+
+/**
+ * @brief ModbusRTU frame received by UART interrupt, closed by t3.5 timeout
+ */
+typedef struct {
+    uint8_t data[UART_RX_BUFFER_SIZE];
+    uint16_t length;
+    bool corrupted; //Parity or framing error, overflow or t1.5 violation
+    uint32_t end_time_us; //Time when the frame was closed by t3.5 alarm
+} modbus_rx_frame;
 
 typedef union {
-    uint8_t raw_data[MODBUS_REQUEST_BASE_LENGTH + CRC_LEN + 1];
+    uint8_t raw_data[UART_RX_BUFFER_SIZE];
     struct {
         uint8_t address;
         uint8_t function_code;
@@ -72,8 +214,18 @@ typedef union {
             uint16_t register_count;
             uint16_t single_register_data;
         };
-        //Last register will hold CRC data
-        uint16_t crc;
+        union {
+            //Last register of fixed length request will hold CRC data
+            uint16_t crc;
+            //WriteMultipleRegisters
+            uint8_t write_byte_count;
+            //ReadWriteMultipleRegisters (first_register and register_count describe read part)
+            struct {
+                uint16_t write_first_register;
+                uint16_t write_register_count;
+                uint8_t read_write_byte_count;
+            };
+        };
     };
 } request_packet; 
 
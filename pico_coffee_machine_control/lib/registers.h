@@ -22,10 +22,16 @@ Due to limitation in ModbusRTU protocol, data must
 be transmitted in multiple transactions.
 */
 
+//Screen consists of 8 pages, each 128 columns wide (every byte carries 8 pixels in column)
+#define SCREEN_PAGE_NUM 8
+#define SCREEN_PAGE_WIDTH 128
+#define SCREEN_PAGE_REGISTER_NUM (SCREEN_PAGE_WIDTH / 2)
+
 /**
  * @brief Used for storing SPI data into the 16-bit registers
  */
 typedef union {
+    uint8_t spi_raw_bytes[SPI_BYTE_NUM + 1];
     uint16_t spi_raw_buffer[(SPI_BYTE_NUM + 1) / 2 + 1];
     struct {
         uint16_t register_group1[MAX_REGISTER_NUM];
@@ -36,6 +42,114 @@ typedef union {
     };
 } spi_registers;
 
+/**
+ * @brief Decoded content of screen (each byte carries 8 pixels in column)
+ */
+typedef union {
+    uint8_t pixels[SCREEN_PAGE_NUM * SCREEN_PAGE_WIDTH];
+    uint8_t pages[SCREEN_PAGE_NUM][SCREEN_PAGE_WIDTH];
+    uint32_t words[SCREEN_PAGE_NUM * SCREEN_PAGE_WIDTH / 4];
+} screen_framebuffer;
+
+/**
+ * @brief Minimum, maximum and sum of measured durations (in us)
+ */
+typedef struct {
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t count;
+} timing_statistics;
+
+/**
+ * @brief Counters of SPI capture path
+ */
+typedef struct {
+    uint32_t frames_received;       //Frames of correct length captured by DMA
+    uint32_t frames_dropped;        //Frames of wrong length or with RX FIFO overflow
+    uint32_t frames_overwritten;    //Frames replaced by newer ones before parsing
+    uint32_t frames_identical;      //Frames with the same hash as published one
+    uint32_t frames_malformed;      //Frames rejected by decoder
+    uint32_t frames_published;
+    uint32_t watchdog_timeouts;
+    uint32_t debounce_alarm_failures;   //Status input edges applied without debounce timer
+    timing_statistics frame_interval;   //Between two received frames
+    timing_statistics publish_latency;  //From end of capture to publishing
+    timing_statistics isr_duration;     //Frame interrupt handler
+} capture_statistics;
+
+#define SCREEN_HISTORY_LEN 16
+#define SCREEN_HISTORY_SLOT_NUM (SCREEN_HISTORY_LEN + 1) //Spare slot is written while reader copies the published entries
+
+/**
+ * @brief Record of one distinct screen frame in history
+ */
+typedef struct {
+    uint32_t timestamp_us;  //Capture time (end of SPI transmission)
+    uint32_t frame_hash;
+    uint16_t sequence;      //Number of frame since start (wraps)
+    uint16_t screen_id;
+} screen_history_entry;
+
+#define INPUT_EVENT_LOG_LEN 30
+#define INPUT_EVENT_SLOT_NUM (INPUT_EVENT_LOG_LEN + 1) //Spare slot is written while reader copies the published entries
+
+/**
+ * @brief Record of one change of input register in event log
+ */
+typedef struct {
+    uint32_t timestamp_us;  //Time of the change (first edge of debounced input)
+    uint16_t sequence;      //Number of change since start (wraps)
+    uint16_t value;         //New value of input register
+} input_event;
+
+/**
+ * @brief Status input debounced by alarm, level is accepted after it is stable for debounce time
+ */
+typedef struct {
+    uint pin;
+    uint32_t debounce_us;
+    bool level;                 //Debounced level
+    uint32_t first_edge_time;   //The first edge since the level was accepted
+    uint32_t last_edge_time;
+    uint32_t transition_time;   //Time of the last accepted transition (its first edge)
+    alarm_id_t alarm;
+} status_input;
+
+#define MACRO_MAX_STEP_NUM 16
+#define MACRO_STEP_REGISTER_NUM 6
+#define MACRO_TICK_US 1000
+
+//Conditions of macro step, step is repeated if its condition is not met until timeout
+#define MACRO_CONDITION_NONE 0          //Only waits for timeout
+#define MACRO_CONDITION_FRAME_CHANGED 1 //Frame hash differs from the one at the beginning of push
+#define MACRO_CONDITION_PAGES_CHANGED 2 //Any page from mask (parameter) changed since the beginning of push
+#define MACRO_CONDITION_SCREEN_ID 3     //Classified screen equals parameter
+#define MACRO_CONDITION_FRAME_HASH 4    //Frame hash equals parameter
+
+//Macro states
+#define MACRO_IDLE 0
+#define MACRO_RUNNING 1
+#define MACRO_DONE 2
+#define MACRO_FAILED 3
+#define MACRO_ABORTED 4
+
+/**
+ * @brief Step of button macro: push buttons, then wait until condition is met
+ */
+typedef union {
+    uint16_t registers[MACRO_STEP_REGISTER_NUM];
+    struct {
+        uint16_t command;       //Value of command register during push, 0 means no push
+        uint16_t push_ms;
+        uint8_t condition;
+        uint8_t repeat_num;     //Number of additional pushes if condition is not met
+        uint16_t timeout_ms;
+        uint16_t parameter_low;
+        uint16_t parameter_high;
+    };
+} macro_step;
+
 /**
  * @brief Input register with diagnostics data from coffee machine
  */
@@ -97,6 +211,16 @@ typedef union {
     };
 } command_register;
 
+//Events of core0 main loop, posted by interrupts and core1
+#define EVENT_SPI_FRAME 0       //New frame is waiting for parsing
+#define EVENT_HOST_READ 1       //Host read data, new data signal must be updated
+#define EVENT_NUM 2
+
+//Commands are sent from core1 to core0 through multicore FIFO, word carries sequence number and command
+#define command_fifo_word(sequence, command) (((uint32_t)(sequence) << 16) | (command))
+#define command_fifo_sequence(word) ((uint16_t)((word) >> 16))
+#define command_fifo_value(word) ((uint16_t)((word) & 0xffff))
+
 //Used to put 16-bit value into buffer of bytes
 #define put_16bit_into_byte_buffer(buffer, offset, value) {(buffer)[(offset) + 1] = ((value) & 0xff00) >> 8; (buffer)[(offset)] = (value) & 0xff;}
 
@@ -0,0 +1,56 @@
+#ifndef SCREEN_CLASSIFIER
+#define SCREEN_CLASSIFIER
+
+#include "lib/registers.h"
+
+/*Screen templates are generated from the screen record database of RPI4 controller
+(see tools/generate_screen_templates.py) and stored in flash. Exact template fits
+only if every pixel matches, mask template fits if all its pixels are lit on screen.
+Screens are compared word by word (32 pixel columns at once). Error templates are 
+used only while the screen is red, other templates only while it is not.
+*/
+
+#define SCREEN_WORD_NUM (SCREEN_PAGE_NUM * SCREEN_PAGE_WIDTH / 4)
+#define SCREEN_NO_MATCH 0xFFFF
+#define SCREEN_MATCH_BITMAP_REGISTER_NUM 4 //Up to 64 templates
+
+typedef enum {
+    TEMPLATE_EXACT = 0,
+    TEMPLATE_MASK = 1
+} screen_template_type;
+
+/**
+ * @brief Screen template, order of templates is the same as order of records in database
+ */
+typedef struct {
+    uint8_t type;
+    bool is_error;      //Template is displayed in error state (red screen)
+    uint16_t weight;    //Number of lit pixels, more specific masks are preferred
+    uint32_t words[SCREEN_WORD_NUM];
+} screen_template;
+
+/**
+ * @brief Result of screen classification
+ */
+typedef struct {
+    uint16_t screen_id;     //Index of best fitting template, SCREEN_NO_MATCH if no template fits
+    uint16_t confidence;    //Percentage of words of the closest template which fit
+    uint16_t match_bitmap[SCREEN_MATCH_BITMAP_REGISTER_NUM]; //Bit n is set if template n fits
+    bool red_screen;        //Level of red screen the screen was classified with
+} screen_classification;
+
+extern const screen_template screen_templates[];
+extern const uint16_t screen_template_num;
+
+/**
+ * @brief Compares screen with all templates whose error flag equals red_screen.
+ * 
+ * If more templates fit, exact templates are preferred over masks, 
+ * then masks with more lit pixels.
+ * @param framebuffer Decoded screen
+ * @param red_screen Debounced level of red screen
+ * @param result Result of classification
+ */
+void classify_screen(volatile screen_framebuffer* framebuffer, bool red_screen, screen_classification* result);
+
+#endif
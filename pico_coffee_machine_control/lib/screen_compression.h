@@ -0,0 +1,30 @@
+#ifndef SCREEN_COMPRESSION
+#define SCREEN_COMPRESSION
+
+#include "lib/registers.h"
+
+/*Screen is encoded as XOR delta against base screen (previous screen acknowledged 
+by host, or empty screen), followed by run-length encoding. Every run starts with
+control byte:
+    0x00 - 0x7F: (value + 1) bytes of delta follow "as is"
+    0x80 - 0xFF: (value - 0x80 + 1) bytes of delta are zero (pixels did not change)
+*/
+
+#define RLE_ZERO_RUN 0x80
+#define RLE_MAX_RUN_LENGTH 128
+#define SCREEN_BYTE_NUM (SCREEN_PAGE_NUM * SCREEN_PAGE_WIDTH)
+//Worst case: changed and unchanged bytes alternate, so every changed byte takes literal run (2 bytes)
+//and every unchanged byte takes zero run (1 byte)
+#define SCREEN_COMPRESSED_MAX_LEN (SCREEN_BYTE_NUM * 3 / 2 + 1)
+
+/**
+ * @brief Encodes screen as run-length encoded XOR delta against base screen.
+ * 
+ * @param screen Screen to be encoded
+ * @param base Base screen
+ * @param output Buffer for encoded data (at least SCREEN_COMPRESSED_MAX_LEN bytes)
+ * @return Length of encoded data in bytes
+ */
+uint16_t compress_screen(const uint8_t* screen, const uint8_t* base, uint8_t* output);
+
+#endif
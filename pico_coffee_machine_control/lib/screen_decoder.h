@@ -0,0 +1,50 @@
+#ifndef SCREEN_DECODER
+#define SCREEN_DECODER
+
+#include "lib/registers.h"
+
+/*The display controller receives a stream of commands and pixel data. Since only MOSI
+and CLK are captured (no A0 signal), data are recognized by the structure of the stream:
+setting of page address is always followed by data for the rest of the page, starting at
+column set by previous column address commands.
+*/
+
+//Display controller commands
+#define CMD_COLUMN_ADDRESS_LOW 0x00     //Lower nibble of column address
+#define CMD_COLUMN_ADDRESS_HIGH 0x10    //Upper nibble of column address
+#define CMD_PAGE_ADDRESS 0xB0           //Lower nibble is page address
+#define CMD_ELECTRONIC_VOLUME 0x81      //Followed by 1 byte of parameter
+#define CMD_BOOSTER_RATIO 0xF8          //Followed by 1 byte of parameter
+#define CMD_GROUP_MASK 0xF0
+#define CMD_VALUE_MASK 0x0F
+
+//First visible column in controller memory
+#define SCREEN_COLUMN_OFFSET 4
+//Maximum number of page writes in 1 SPI transmission
+#define SCREEN_MAX_PAGE_WRITES (2 * SCREEN_PAGE_NUM)
+
+/**
+ * @brief Single write of pixel data into one page of screen
+ */
+typedef struct {
+    uint8_t page;
+    uint8_t column;         //First column (visible area)
+    uint8_t length;         //Number of data bytes
+    uint16_t data_offset;   //Position of data in SPI transmission
+} screen_page_write;
+
+/**
+ * @brief Decodes SPI transmission and writes its pixel data into framebuffer.
+ * 
+ * Pages may be written partially and in any order, pages which are not written
+ * keep their content. If the transmission is malformed (invalid page or column address, 
+ * truncated data), nothing is written.
+ * @param frame Received SPI bytes
+ * @param length Number of received bytes
+ * @param framebuffer Framebuffer to be updated
+ * @param changed_pages Bit n is set if content of page n changed
+ * @return True if transmission was decoded, false if it was rejected.
+ */
+bool decode_screen_frame(volatile uint8_t* frame, uint16_t length, volatile screen_framebuffer* framebuffer, uint8_t* changed_pages);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SCREEN_SNAPSHOT
+#define SCREEN_SNAPSHOT
+
+#include "lib/registers.h"
+#include "lib/screen_classifier.h"
+
+/*Every published frame is stored in its own snapshot with increasing generation number.
+Core0 writes only into a snapshot which is neither the latest one, nor the one pinned by reader
+(core1), so the reader never blocks capture and pinned data are never modified while they are read.
+*/
+
+#define SCREEN_SNAPSHOT_NUM 3 //Written, latest and pinned snapshot
+
+/**
+ * @brief Published screen frame with all data derived from it
+ */
+typedef struct {
+    uint32_t generation;
+    uint32_t frame_hash;
+    uint16_t page_versions[SCREEN_PAGE_NUM];
+    screen_classification classification;
+    spi_registers raw;
+    screen_framebuffer screen;
+} screen_snapshot;
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef TUSB_CONFIG
+#define TUSB_CONFIG
+
+/*TinyUSB configuration for USB transport (MODBUS_USB_TRANSPORT), device with one CDC interface.
+Stdio is not connected to USB, so the CDC channel carries only frames of register protocol.
+*/
+
+#define CFG_TUSB_RHPORT0_MODE OPT_MODE_DEVICE
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+#define CFG_TUD_CDC 1
+#define CFG_TUD_CDC_RX_BUFSIZE 512  //Holds at least one complete frame with MBAP header
+#define CFG_TUD_CDC_TX_BUFSIZE 512
+#define CFG_TUD_CDC_EP_BUFSIZE 64
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef USB_TRANSPORT
+#define USB_TRANSPORT
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+/*Register protocol over USB CDC, used instead of ModbusRTU UART when built with MODBUS_USB_TRANSPORT option.
+Every frame starts with MBAP header (as in ModbusTCP): transaction ID, protocol ID (0) and number of following 
+bytes, all in big endian. Header is followed by unit ID and PDU, which have the same layout as ModbusRTU frame 
+without CRC, so requests are handled by the same handlers. Frames are delimited by length (no silent intervals),
+response carries transaction ID of request.
+
+TinyUSB runs on core1 directly (stdio is not connected to USB, see tusb_config.h), core1 sleeps until USB 
+interrupt and received data are signalized by tud_cdc_rx_cb.
+*/
+
+#define MBAP_HEADER_LEN 6 //Without unit ID
+#define USB_MAX_FRAME_LEN 254 //Unit ID + PDU, the same as ModbusRTU frame without CRC
+#define USB_FRAME_TIMEOUT_US 100000 //Incomplete frame is dropped if the rest does not arrive in time
+
+extern volatile bool usb_rx_pending;
+
+/**
+ * @brief Initializes TinyUSB device stack, USB interrupt is handled by the calling core.
+ */
+void usb_transport_init();
+
+/**
+ * @brief Processes USB events, must be called after every wake-up of the core.
+ */
+void usb_transport_task();
+
+/**
+ * @brief Reads received data from USB and assembles request frame.
+ * 
+ * @param data Buffer for unit ID and PDU (at least USB_MAX_FRAME_LEN bytes)
+ * @param length Length of received frame
+ * @return True if complete frame was received, false if all received data were consumed.
+ */
+bool usb_receive_frame(uint8_t* data, uint16_t* length);
+
+/**
+ * @brief Sends response frame with MBAP header of the last request.
+ * 
+ * @param data Unit ID and PDU
+ * @param length Length of data
+ */
+void usb_send_frame(const volatile uint8_t* data, uint16_t length);
+
+#endif
@@ -0,0 +1,41 @@
+#include <string.h>
+#include "lib/latency_histogram.h"
+
+#ifdef LATENCY_INSTRUMENTATION
+
+latency_histogram latency_histograms[LATENCY_SITE_NUM] = {0};
+spin_lock_t* latency_histogram_lock = NULL; //Sites are recorded by both cores
+
+void init_latency_instrumentation(){
+    if (latency_histogram_lock == NULL){
+        latency_histogram_lock = spin_lock_init(spin_lock_claim_unused(true));
+    }
+    systick_hw->rvr = SYSTICK_MAX_VALUE;
+    systick_hw->cvr = 0;
+    systick_hw->csr = SYSTICK_CSR_ENABLE_CPU_CLOCK;
+}
+
+void __time_critical_func(record_latency)(int site, uint32_t value){
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= LATENCY_BUCKET_NUM){
+        bucket = LATENCY_BUCKET_NUM - 1;
+    }
+
+    uint32_t interrupts = spin_lock_blocking(latency_histogram_lock);
+    latency_histograms[site].buckets[bucket]++;
+    if (value > latency_histograms[site].max){
+        latency_histograms[site].max = value;
+    }
+    spin_unlock(latency_histogram_lock, interrupts);
+}
+
+void read_latency_histograms(latency_histogram* histograms, bool reset){
+    uint32_t interrupts = spin_lock_blocking(latency_histogram_lock);
+    memcpy(histograms, latency_histograms, sizeof(latency_histograms));
+    if (reset == true){
+        memset(latency_histograms, 0, sizeof(latency_histograms));
+    }
+    spin_unlock(latency_histogram_lock, interrupts);
+}
+
+#endif
@@ -12,19 +12,23 @@
 //SPI sm data
 volatile bool spi_sm_started = false;
 uint spi_sm_offset = 0;
+uint spi_frame_sm_offset = 0;
 
 //SPI DMA variables
 int dma_channel_spi_read = DUMMY_NUM;
 dma_channel_config dma_config_spi_read;
 
-//SPI alarms
-volatile alarm_id_t spi_sync_timer = -1;
-volatile alarm_id_t spi_recv_watchdog = -1;
+//SPI watchdog
+volatile uint32_t spi_recv_last_seen_time = 0; //Time of the last received frame, checked by watchdog service
 
-//SPI data (+ 1 value for alignment and 1 for terminal zero)
-volatile uint32_t spi_rx_buffer_dma[SPI_BYTE_NUM + 2] = {0};
-volatile uint32_t spi_rx_buffer[SPI_BYTE_NUM + 2] = {0};
-bool spi_new_data = false;
+//SPI frames, packed by bytes (+ 1 byte for alignment to 16-bit registers)
+volatile uint8_t spi_frame_buffers[SPI_FRAME_BUFFER_NUM][SPI_BYTE_NUM + 1] __attribute__((aligned(4))) = {0};
+volatile int spi_dma_buffer = 0;                //Buffer currently written by DMA
+volatile int spi_ready_buffer = SPI_NO_FRAME;   //Newest complete frame, waiting for parsing
+volatile int spi_parsed_buffer = SPI_NO_FRAME;  //Frame currently owned by parser
+volatile uint32_t spi_frame_hashes[SPI_FRAME_BUFFER_NUM] = {0}; //Calculated by DMA sniffer during capture
+volatile uint32_t spi_frame_times[SPI_FRAME_BUFFER_NUM] = {0};  //Capture timestamps (in us)
+volatile uint32_t spi_last_frame_time = 0;                      //0 if no frame was received since start
 
 
 
@@ -42,7 +46,7 @@ int dma_channel_reg_write = DUMMY_NUM;
 dma_channel_config dma_config_reg_write;
 
 //Register watchdog
-volatile alarm_id_t reg_handler_watchdog = -1;
+volatile uint32_t reg_handler_last_seen_time = 0; //Time of the last register scan, checked by watchdog service
 
 //Register data
 volatile uint32_t register_data_dma = 0;
@@ -56,19 +60,145 @@ volatile uint32_t button_input_command_mismatch_num = 0;
 
 //Other variables
 volatile alarm_id_t push_button_timer = -1;
-volatile alarm_id_t standby_detection_alarm = -1;
+volatile uint32_t standby_led_last_seen_time = 0; //Time of the last standby LED pulse, checked by watchdog service
+volatile status_input status_inputs[STATUS_INPUT_NUM] = {
+    {.pin = POWER_5V_PIN, .debounce_us = POWER_5V_DEBOUNCE_US, .alarm = -1},
+    {.pin = SCREEN_RED_PIN, .debounce_us = SCREEN_DEBOUNCE_US, .alarm = -1},
+    {.pin = SCREEN_WHITE_PIN, .debounce_us = SCREEN_DEBOUNCE_US, .alarm = -1},
+    {.pin = POWER_BUTTON_PIN, .debounce_us = POWER_BUTTON_DEBOUNCE_US, .alarm = -1}
+};
 //volatile alarm_id_t pio_machines_start_delay_timer = -1;
 event_register last_input_data = {.raw_data = 0};
+uint16_t logged_input_data = 0; //Value of input register in the newest log entry
+
+//Macro engine (runs in alarm callbacks on core0)
+#define MACRO_PHASE_PUSH 0
+#define MACRO_PHASE_RELEASE 1
+#define MACRO_PHASE_WAIT 2
+volatile uint8_t macro_phase = MACRO_PHASE_PUSH;
+volatile uint8_t macro_repetition = 0;
+volatile uint32_t macro_phase_start_time = 0;
+volatile uint32_t macro_start_hash = 0;                         //Frame hash at the beginning of push
+volatile uint16_t macro_start_page_versions[SCREEN_PAGE_NUM] = {0};
+volatile bool macro_saved_clear_disabled = false;               //Host setting, restored when macro ends
+
+
+
+
+//Input event log
+/**
+ * @brief Stores change of input register into event log ring. Must be called with input data locked.
+ * 
+ * Counter is incremented only after the entry is complete, so the reader can detect 
+ * that log was modified during reading. Ring has one slot more than is published,
+ * so the entry being written is never the one being read.
+ * @param value New value of input register
+ * @param timestamp_us Time of the change
+ */
+void __time_critical_func(record_input_event)(uint16_t value, uint32_t timestamp_us){
+    volatile input_event* entry = &input_event_log[input_event_count % INPUT_EVENT_SLOT_NUM];
+    entry->timestamp_us = timestamp_us;
+    entry->sequence = (uint16_t)(input_event_count + 1);
+    entry->value = value;
+    __dmb();
+    input_event_count++;
+}
+
+/**
+ * @brief Locks input data before it is modified (called by both cores).
+ * 
+ * @return Saved interrupt state for unlock_input_data()
+ */
+uint32_t __time_critical_func(lock_input_data)(){
+    return spin_lock_blocking(input_data_lock);
+}
+
+/**
+ * @brief Logs change of input data (if any) and unlocks it.
+ * 
+ * @param interrupts Interrupt state returned by lock_input_data()
+ * @param timestamp_us Time of the change
+ */
+void __time_critical_func(unlock_input_data)(uint32_t interrupts, uint32_t timestamp_us){
+    if (input_data.raw_data != logged_input_data){
+        logged_input_data = input_data.raw_data;
+        record_input_event(logged_input_data, timestamp_us);
+    }
+    spin_unlock(input_data_lock, interrupts);
+}
+
+
+
+
+
+//Core0 events
+/**
+ * @brief Posts event to core0 main loop and wakes it up. Can be called from interrupts and core1.
+ * 
+ * Every event has its own flag, so no locking is needed. SEV also sets event register
+ * of this core, so the event is not lost if it is posted just before main loop sleeps.
+ * @param event Event number
+ */
+void __time_critical_func(post_event)(int event){
+    core0_events[event] = true;
+    __dmb();
+    __sev();
+}
+
+/**
+ * @brief Takes posted event. Flag is cleared before the event is handled, 
+ * so event posted during handling is kept for the next loop.
+ * 
+ * @param event Event number
+ * @return True if event was posted, false otherwise.
+ */
+bool take_event(int event){
+    if (core0_events[event] == false){
+        return false;
+    }
+    core0_events[event] = false;
+    __dmb();
+    return true;
+}
+
+/**
+ * @brief Checks whether any event is waiting for handling.
+ * 
+ * @return True if any event was posted, false otherwise.
+ */
+bool is_event_pending(){
+    for (int event = 0; event < EVENT_NUM; ++event){
+        if (core0_events[event] == true){
+            return true;
+        }
+    }
+    return false;
+}
 
 
 
 
 //PIO start methods
 /**
- * @brief Starts SPI receiving by enabling interrupt on SPI CS pin
+ * @brief Points SPI DMA channel to the beginning of current DMA buffer and starts it.
+ */
+void __time_critical_func(arm_spi_dma)(){
+    dma_channel_abort(dma_channel_spi_read);
+    dma_hw->sniff_data = SPI_FRAME_HASH_SEED;
+    dma_channel_set_trans_count(dma_channel_spi_read, SPI_BYTE_NUM, false);
+    dma_channel_set_write_addr(dma_channel_spi_read, spi_frame_buffers[spi_dma_buffer], true);
+}
+
+/**
+ * @brief Starts SPI receiving. 
+ * 
+ * Receiver may start in the middle of frame, such frame is dropped at its end
+ * because of wrong length.
  */
 void __time_critical_func(start_spi_receiver)(){
-    gpio_set_irq_enabled(SPI_CS_PIN, GPIO_IRQ_EDGE_FALL, true);
+    pio_sm_clear_fifos(SPI_PIO, SPI_SM);
+    arm_spi_dma();
+    pio_sm_set_enabled(SPI_PIO, SPI_SM, true);
  }
 
  /**
@@ -85,26 +215,13 @@ void __time_critical_func(start_spi_receiver)(){
  * @brief Resets PIO machine for SPI receiving
  */
 void __time_critical_func(reset_spi_receiver)(){
-    gpio_set_irq_enabled(SPI_CS_PIN, GPIO_IRQ_EDGE_FALL, false);
-    if (spi_sync_timer != -1){
-        cancel_alarm(spi_sync_timer);
-        spi_sync_timer = -1;
-    }
-
     pio_sm_set_enabled(SPI_PIO, SPI_SM, false);
     pio_sm_restart(SPI_PIO, SPI_SM);
     pio_sm_clkdiv_restart(SPI_PIO, SPI_SM);
     pio_sm_exec(SPI_PIO, SPI_SM, pio_encode_jmp(spi_sm_offset));
 
-    dma_channel_set_irq0_enabled(dma_channel_spi_read, false);
     dma_channel_abort(dma_channel_spi_read);
-    dma_channel_acknowledge_irq0(dma_channel_spi_read);
-    dma_channel_set_irq0_enabled(dma_channel_spi_read, true);
-    dma_channel_set_write_addr(dma_channel_spi_read, spi_rx_buffer_dma, false);
-
-    //memset((void*)spi_rx_buffer_dma, 0, SPI_BYTE_NUM);
-    //memset((void*)spi_rx_buffer, 0, SPI_BYTE_NUM);
-    //memset((void*)spi_parsed_data.spi_raw_bytes, 0, SPI_BYTE_NUM);
+    spi_last_frame_time = 0;
 }
 
 /**
@@ -128,81 +245,145 @@ void __time_critical_func(reset_reg_handler)(){
 
     register_data_dma = 0;
     register_command_dma = 0;
+    uint32_t interrupts = lock_input_data();
     input_data.buttons = 0;
+    unlock_input_data(interrupts, time_us_32());
 }
 
 
 
 
 
-//Alarms and timers callbacks
-
+//Capture statistics
 /**
- * @brief Callback for standby mode detection. 
+ * @brief Adds one sample into timing statistics. Must be called with statistics locked.
  * 
- * Standby is signalized by LED blinking every STANDBY_LED_TIMEOUS_US. 
- * If the timer finishes, the coffee machine is no longer in standby mode.
- * @param id Not used
- * @param user_data Not used
- * @return 0
+ * @param stats Statistics to update
+ * @param value Measured duration (in us)
  */
-int64_t __time_critical_func(standby_not_detected_callback)(alarm_id_t id, __unused void *user_data){
-    input_data.standby_on = false;
-    standby_detection_alarm = -1;
-
-    return 0;
+void __time_critical_func(add_timing_sample)(volatile timing_statistics* stats, uint32_t value){
+    if (stats->count == 0 || value < stats->min){
+        stats->min = value;
+    }
+    if (stats->count == 0 || value > stats->max){
+        stats->max = value;
+    }
+    stats->sum += value;
+    stats->count++;
 }
 
 /**
- * @brief Callback for spi_recv state machine watchdog.
+ * @brief Increments one capture counter.
  * 
- * When timer finishes, spi_recv state machine has stopped sending data and should be reset.
- * @param id Not used
- * @param user_data Not used
- * @return 0
+ * @param counter Counter from capture_stats
  */
-int64_t __time_critical_func(spi_recv_watchdog_callback)(alarm_id_t id, __unused void *user_data){
-    input_data.spi_recv_running = false;
-    spi_recv_watchdog = -1;
-    return 0;
+void __time_critical_func(count_capture_event)(volatile uint32_t* counter){
+    uint32_t interrupts = spin_lock_blocking(capture_statistics_lock);
+    (*counter)++;
+    spin_unlock(capture_statistics_lock, interrupts);
 }
 
 /**
- * @brief Callback for reg_handler state machine watchdog.
+ * @brief Copies capture statistics as 32-bit values and optionally resets them. Called by core1.
  * 
- * When timer finishes, reg_handler state machine has stopped sending data and should be reset.
- * @param id Not used
- * @param user_data Not used
- * @return 0
+ * Order of values: counters (as in capture_statistics), then min, avg and max
+ * of frame interval, publish latency and ISR duration.
+ * @param values Output buffer (CAPTURE_STATISTICS_VALUE_NUM values)
+ * @param reset If true, statistics are reset after copying
  */
-int64_t __time_critical_func(reg_handler_watchdog_callback)(alarm_id_t id, __unused void *user_data){
-    input_data.reg_handler_running = false;
-    reg_handler_watchdog = -1;
+void read_capture_statistics(uint32_t* values, bool reset){
+    uint32_t interrupts = spin_lock_blocking(capture_statistics_lock);
+    capture_statistics stats = capture_stats;
+    if (reset){
+        memset((void*)&capture_stats, 0, sizeof(capture_stats));
+    }
+    spin_unlock(capture_statistics_lock, interrupts);
+
+    values[0] = stats.frames_received;
+    values[1] = stats.frames_dropped;
+    values[2] = stats.frames_overwritten;
+    values[3] = stats.frames_identical;
+    values[4] = stats.frames_malformed;
+    values[5] = stats.frames_published;
+    values[6] = stats.watchdog_timeouts;
+    values[7] = stats.debounce_alarm_failures;
+
+    timing_statistics* timings[] = {&stats.frame_interval, &stats.publish_latency, &stats.isr_duration};
+    for (int i = 0; i < 3; ++i){
+        values[8 + i * 3] = timings[i]->min;
+        values[9 + i * 3] = timings[i]->count == 0 ? 0 : (uint32_t)(timings[i]->sum / timings[i]->count);
+        values[10 + i * 3] = timings[i]->max;
+    }
+}
 
-    register_data_dma = 0;
-    input_data.buttons = 0;
-    command_data.buttons = 0;
+
+
+
+
+//SPI frame buffers
+/**
+ * @brief Finds frame buffer which is neither waiting for parsing nor being parsed.
+ * 
+ * With SPI_FRAME_BUFFER_NUM buffers, there is always at least one free.
+ * @return Index of free buffer
+ */
+int __time_critical_func(get_free_spi_buffer)(){
+    for (int i = 0; i < SPI_FRAME_BUFFER_NUM; ++i){
+        if (i != spi_ready_buffer && i != spi_parsed_buffer){
+            return i;
+        }
+    }
     return 0;
 }
 
+
+
+
+
+//Alarms and timers callbacks
+
 /**
- * @brief Callback for SPI timer. 
- * 
- * This timer starts when the falling edge on CS pin is detected and lasts for 
- * SPI_TRANSMISSION_TIME_US. When done, it enables state machine receiving SPI traffic.
+ * @brief Callback for watchdog service, fired every WATCHDOG_SERVICE_PERIOD_US.
  * 
- * This mechanism is implemented to ensure proper synchronization with coffee machine.
- * Even if SPI CLK signal gets interrupted, PIO machine will resync with following 
- * SPI transmission. 
+ * Interrupts only store the time when the signal was last seen, timeouts are checked here
+ * (so they are detected up to WATCHDOG_SERVICE_PERIOD_US later).
+ * @section spi_recv: If no frame was received, spi_recv state machine has stopped sending data and should be reset.
+ * @section reg_handler: If no register scan finished, reg_handler state machine has stopped sending data and should be reset.
+ * @section STANDBY_LED: Standby is signalized by LED blinking every STANDBY_LED_TIMEOUS_US.
+ * If no pulse was detected, the coffee machine is no longer in standby mode.
  * @param id Not used
  * @param user_data Not used
- * @return 0
+ * @return Negative period, so the service runs at fixed rate
  */
-int64_t __time_critical_func(spi_sync_timer_callback)(alarm_id_t id, __unused void *user_data){
-    spi_sync_timer = -1;
-    pio_sm_set_enabled(SPI_PIO, SPI_SM, true);
-    dma_channel_start(dma_channel_spi_read);
-    return 0;
+int64_t __time_critical_func(watchdog_service_callback)(alarm_id_t id, __unused void *user_data){
+    LATENCY_START(start);
+    uint32_t now = time_us_32();
+    bool spi_timeout = false;
+    uint32_t interrupts = lock_input_data();
+
+    if (input_data.spi_recv_running == true && now - spi_recv_last_seen_time > SPI_RECV_WATCHDOG_TIMEOUT_US){
+        input_data.spi_recv_running = false;
+        spi_timeout = true;
+    }
+
+    if (input_data.reg_handler_running == true && now - reg_handler_last_seen_time > REG_HANDLER_WATCHDOG_TIMEOUT_US){
+        input_data.reg_handler_running = false;
+        register_data_dma = 0;
+        input_data.buttons = 0;
+        command_data.buttons = 0;
+    }
+
+    if (input_data.standby_on == true && now - standby_led_last_seen_time > STANDBY_LED_TIMEOUT_US){
+        input_data.standby_on = false;
+    }
+
+    unlock_input_data(interrupts, now);
+    if (spi_timeout == true){
+        count_capture_event(&capture_stats.watchdog_timeouts);
+    }
+
+    LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+    return -WATCHDOG_SERVICE_PERIOD_US;
 }
 
 /**
@@ -214,16 +395,20 @@ int64_t __time_critical_func(spi_sync_timer_callback)(alarm_id_t id, __unused vo
  * @return 0
  */
 int64_t __time_critical_func(push_button_timer_callback)(alarm_id_t id, __unused void *user_data){
+    LATENCY_START(start);
     //If power button should have been pushed but is not
+    uint32_t interrupts = lock_input_data();
     if (command_data.power_button_push == true && input_data.power_button_pushed == false){
         input_data.button_push_failed = true;  
     }
+    unlock_input_data(interrupts, time_us_32());
 
     command_data.buttons = 0;
     command_data.power_button_push = false;
 
     gpio_put(POWER_BUTTON_CONTROL, false);
     push_button_timer = -1;
+    LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
     return 0;
 }
 
@@ -233,89 +418,191 @@ int64_t __time_critical_func(push_button_timer_callback)(alarm_id_t id, __unused
 
 //Interrupt handlers
 /**
- * @brief Global interrupt handler for GPIO pins
- * @section SPI_CS: Detects whether SPI CS pin goes low, which signalizes the beginning of 
- * SPI transaction. This interrupt is fired only once before disabled. It is used to synchronize
- * SPI receiver with coffee machine (see spi_sync_timer_callback()).
- * @section POWER_BUTTON: Detects whether Main switch has been pushed.
- * @section STANDBY_ON: Detects whether the machine is in standby mode.
+ * @brief Starts or stops PIO machines according to screen backlight.
+ */
+void __time_critical_func(update_pio_machines_state)(){
+    //If screen is lighting, start PIO machines (debounced levels, so backlight flicker is ignored)
+    if (input_data.red_screen == true || input_data.white_screen == true){
+        if (spi_sm_started == false){
+            start_spi_receiver();
+            spi_sm_started = true;
+        }
+        if (reg_sm_started == false){
+            start_reg_handler();
+            reg_sm_started = true;
+        }
+    }
+
+    //If screen does not light, stop PIO machines
+    if (input_data.red_screen == false && input_data.white_screen == false){
+        if (spi_sm_started == true){
+            reset_spi_receiver();
+            spi_sm_started = false;
+        }
+        if (reg_sm_started == true){
+            reset_reg_handler();
+            reg_sm_started = false;
+        }
+    }
+}
+
+//Status detection
+/**
+ * @brief Applies debounced level of status input to input register.
+ * @section POWER_5V: Detects whether the machine is powered on.
+ * @section SCREEN_RED: Detects whether the screen goes red, which signalizes error state.
+ * @section SCREEN_WHITE: Detects whether the screen goes white, which signalizes that coffee
+ * machine is in operational state.
+ * @section POWER_BUTTON: Detects whether Main switch has been pushed (active low).
  * 
- * @param gpio Number of pin
- * @param event_mask Type of event which caused interrupt
+ * @param index Index of status input
+ * @param level Debounced level
+ * @param timestamp_us Time of transition, logged with the change
  */
-void __time_critical_func(gpio_irq_handler)(uint gpio, uint32_t event_mask){
+void __time_critical_func(apply_status_input)(int index, bool level, uint32_t timestamp_us){
+    uint32_t interrupts = lock_input_data();
+    switch (index){
+        case STATUS_INPUT_POWER_5V:
+            input_data.powered_on = level;
+            break;
+        case STATUS_INPUT_SCREEN_RED:
+            input_data.red_screen = level;
+            break;
+        case STATUS_INPUT_SCREEN_WHITE:
+            input_data.white_screen = level;
+            break;
+        case STATUS_INPUT_POWER_BUTTON:
+            input_data.power_button_pushed = !level;
+            //If the button was pushed manually
+            if (level == false && command_data.power_button_push == false){
+                input_data.button_pushed_manually = true;
+            }
+            break;
+    }
+    unlock_input_data(interrupts, timestamp_us);
 
-    //Handler for SPI CS pin
-    if (gpio == SPI_CS_PIN && event_mask == GPIO_IRQ_EDGE_FALL){
+    //Modifies input data as well, so it is called after unlock
+    if (index == STATUS_INPUT_SCREEN_RED || index == STATUS_INPUT_SCREEN_WHITE){
+        update_pio_machines_state();
+    }
+}
 
-        gpio_set_irq_enabled(SPI_CS_PIN, GPIO_IRQ_EDGE_FALL, false); //Disable interrupts, for data are comming
-        spi_sync_timer = add_alarm_in_us(SPI_TRANSMISSION_TIME_US, spi_sync_timer_callback, NULL, false);
+/**
+ * @brief Callback for debounce timer of status input.
+ * 
+ * Timer is postponed while the pin keeps changing, level is accepted 
+ * when no edge occured for the whole debounce time.
+ * @param id Not used
+ * @param user_data Index of status input
+ * @return 0 when level was accepted, otherwise negative time to the end of debounce window
+ */
+int64_t __time_critical_func(status_input_debounce_callback)(alarm_id_t id, void *user_data){
+    LATENCY_START(start);
+    int index = (int)(uintptr_t)user_data;
+    volatile status_input* input = &status_inputs[index];
+
+    uint32_t stable_time = time_us_32() - input->last_edge_time;
+    if (stable_time < input->debounce_us){
+        LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+        return -(int64_t)(input->debounce_us - stable_time);
     }
 
-    //Handler for standby mode detection
-    if (gpio == STANDBY_LED_PIN && event_mask == GPIO_IRQ_EDGE_RISE){
-        if (standby_detection_alarm != -1){
-            cancel_alarm(standby_detection_alarm);
-        }
-        if (input_data.standby_on == false){
-            input_data.standby_on = true;  
+    input->alarm = -1;
+    bool level = gpio_get(input->pin);
+    if (level != input->level){
+        input->level = level;
+        input->transition_time = input->first_edge_time;
+        apply_status_input(index, level, input->transition_time);
+    }
+    LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+    return 0;
+}
+
+/**
+ * @brief Registers edge on status input and starts its debounce timer.
+ * 
+ * If the timer cannot be started, current level is applied without debouncing, so the edge is not lost.
+ * @param index Index of status input
+ */
+void __time_critical_func(debounce_status_input)(int index){
+    volatile status_input* input = &status_inputs[index];
+    input->last_edge_time = time_us_32();
+    if (input->alarm == -1){
+        input->first_edge_time = input->last_edge_time;
+        input->alarm = add_alarm_in_us(input->debounce_us, status_input_debounce_callback, (void*)(uintptr_t)index, false);
+        if (input->alarm <= 0){
+            input->alarm = -1;
+            count_capture_event(&capture_stats.debounce_alarm_failures);
+            bool level = gpio_get(input->pin);
+            if (level != input->level){
+                input->level = level;
+                input->transition_time = input->first_edge_time;
+                apply_status_input(index, level, input->transition_time);
+            }
         }
-        standby_detection_alarm = add_alarm_in_us(STANDBY_LED_TIMEOUT_US, standby_not_detected_callback, NULL, false);
     }
+}
+
+/**
+ * @brief Reads initial levels of status inputs.
+ */
+void init_status_inputs(){
+    for (int index = 0; index < STATUS_INPUT_NUM; ++index){
+        status_inputs[index].level = gpio_get(status_inputs[index].pin);
+        status_inputs[index].transition_time = time_us_32();
+        apply_status_input(index, status_inputs[index].level, status_inputs[index].transition_time);
+    }
+}
 
-    //Handler for power button push
-    if (gpio == POWER_BUTTON_PIN && event_mask == GPIO_IRQ_EDGE_FALL){
-        input_data.power_button_pushed = true;
+/**
+ * @brief Global interrupt handler for GPIO pins
+ * @section STANDBY_ON: Detects whether the machine is in standby mode. The signal on
+ * this pin must be detected before STANDBY_LED_TIMEOUS_US time passes. If not, the 
+ * machine is no longer in standby mode.
+ * @section POWER_5V, SCREEN_RED, SCREEN_WHITE, POWER_BUTTON: Edges start debounce timer of status input.
+ * 
+ * @param gpio Number of pin
+ * @param event_mask Type of event which caused interrupt
+ */
+void __time_critical_func(gpio_irq_handler)(uint gpio, uint32_t event_mask){
+    LATENCY_START(start);
 
-        //If the button was pushed manually
-        if (command_data.power_button_push == false){
-            input_data.button_pushed_manually = true;
+    //Debounced status inputs
+    for (int index = 0; index < STATUS_INPUT_NUM; ++index){
+        if (gpio == status_inputs[index].pin){
+            debounce_status_input(index);
         }
     }
-    else if (gpio == POWER_BUTTON_PIN && event_mask == GPIO_IRQ_EDGE_RISE){
-        input_data.power_button_pushed = false;
 
+    //Handler for standby mode detection
+    if (gpio == STANDBY_LED_PIN && event_mask == GPIO_IRQ_EDGE_RISE){
+        standby_led_last_seen_time = time_us_32();
+        uint32_t interrupts = lock_input_data();
+        input_data.standby_on = true;
+        unlock_input_data(interrupts, standby_led_last_seen_time);
     }
+    LATENCY_END(LATENCY_SITE_GPIO_IRQ, start);
 }
 
 /**
  * @brief Global interrupt handler for DMA
- * @section dma_channel_spi_read: Fired when SPI transaction finished (SPI_BYTE_NUM bytes has been read).
  * @section dma_channel_reg_read: Fired when reading from button shift register finished.
  * @section dma_channel_reg_write: Fired when button push was executed. 
  */
 void __time_critical_func(dma_irq0_handler)() {
-    if (dma_hw->ints0 & (1u << dma_channel_spi_read)){
-        dma_hw->ints0 = 1u << dma_channel_spi_read;
-        
-        //Do not update if old data has not been parsed yet or old ones are being transmitted
-        if (spi_new_data == false){
-            if (memcmp((void*)spi_rx_buffer, (const void*)spi_rx_buffer_dma, sizeof(uint32_t) * SPI_BYTE_NUM) != 0){
-                memcpy((void*)spi_rx_buffer, (const void*)spi_rx_buffer_dma, sizeof(uint32_t) * SPI_BYTE_NUM);
-                spi_new_data = true;
-            }   
-        }
-        dma_channel_set_write_addr(dma_channel_spi_read, spi_rx_buffer_dma, true);
-
-        if (spi_recv_watchdog != -1){
-            cancel_alarm(spi_recv_watchdog);
-        }
-        input_data.spi_recv_running = true;
-        spi_recv_watchdog = add_alarm_in_us(SPI_RECV_WATCHDOG_TIMEOUT_US, spi_recv_watchdog_callback, NULL, false);
-        
-        reset_spi_receiver();
-        start_spi_receiver();
-    }
-
+    LATENCY_START(start);
     if (dma_hw->ints0 & (1u << dma_channel_reg_read)){
         // Clear the interrupt request.
         dma_hw->ints0 = 1u << dma_channel_reg_read;
 
+        uint32_t now = time_us_32();
+        uint32_t interrupts = lock_input_data();
+        //Error flags share byte with buttons, they are kept until host reads them
+        bool pushed_manually = input_data.button_pushed_manually;
+        bool push_failed = input_data.button_push_failed;
         input_data.buttons = ((~register_data_dma) >> 24);
-
-        //To keep error flags
-        input_data.button_pushed_manually = last_input_data.button_pushed_manually;
-        input_data.button_push_failed = last_input_data.button_push_failed;
+        input_data.button_pushed_manually = pushed_manually;
+        input_data.button_push_failed = push_failed;
 
         //Detects if the requested buttons have been pushed or button was pushed manually
         if (input_data.buttons != command_data.buttons){
@@ -338,11 +625,9 @@ void __time_critical_func(dma_irq0_handler)() {
             button_input_command_mismatch_num = 0;
         }
         
-        if (reg_handler_watchdog != -1){
-            cancel_alarm(reg_handler_watchdog);
-        }
+        reg_handler_last_seen_time = now;
         input_data.reg_handler_running = true;
-        reg_handler_watchdog = add_alarm_in_us(REG_HANDLER_WATCHDOG_TIMEOUT_US, reg_handler_watchdog_callback, NULL, false);
+        unlock_input_data(interrupts, now);
         
         dma_channel_start(dma_channel_reg_read);
     }
@@ -353,78 +638,267 @@ void __time_critical_func(dma_irq0_handler)() {
         register_command_dma = command_data.buttons;
         dma_channel_start(dma_channel_reg_write);
     }
+    LATENCY_END(LATENCY_SITE_DMA_IRQ0, start);
 }
 
 
 
 
 
-//Status detection
 /**
- * @brief Detects whether the machine is powered on and machine error status
- * @section POWER_5V: Detects whether the machine is powered on.
- * @section STANDBY_LED: Detects whether the machine is in standby mode. The signal on
- * this pin must be detected before STANDBY_LED_TIMEOUS_US time passes. If not, the 
- * machine is no longer in standby mode.
- * @section SCREEN_RED: Detects whether the screen goes red, which signalizes error state.
- * @section SCREEN_WHITE: Detects whether the screen goes white, which signalizes that coffee
- * machine is in operational state.
+ * @brief Interrupt handler for PIO0 IRQ 0
+ * @section SPI_FRAME_IRQ: Fired by spi_frame machine at the end of every SPI frame (rising edge of CS).
+ * Frame of correct length is handed over to parser and DMA continues into a free buffer. Bit receiver
+ * is realigned to byte boundary, so glitches on CLK line affect only one frame.
  */
-void detect_status(){
+void __time_critical_func(pio0_irq0_handler)(){
+    LATENCY_START(start);
+    if (pio_interrupt_get(SPI_PIO, SPI_FRAME_IRQ)){
+        pio_interrupt_clear(SPI_PIO, SPI_FRAME_IRQ);
+
+        if (spi_sm_started == true){
+            uint32_t isr_start = time_us_32();
+
+            //Last byte may still be in flight
+            while (dma_channel_is_busy(dma_channel_spi_read) && pio_sm_is_rx_fifo_empty(SPI_PIO, SPI_SM) == false);
+
+            uint32_t received = SPI_BYTE_NUM - dma_channel_hw_addr(dma_channel_spi_read)->transfer_count;
+            bool overflow = pio_sm_is_rx_fifo_empty(SPI_PIO, SPI_SM) == false || 
+                (SPI_PIO->fdebug & (1u << (PIO_FDEBUG_RXSTALL_LSB + SPI_SM))) != 0;
+
+            dma_channel_abort(dma_channel_spi_read);
+            pio_sm_exec(SPI_PIO, SPI_SM, pio_encode_mov(pio_isr, pio_null));
+            pio_sm_clear_fifos(SPI_PIO, SPI_SM);
+            SPI_PIO->fdebug = 1u << (PIO_FDEBUG_RXSTALL_LSB + SPI_SM);
+
+            //Completed frame replaces the unparsed one (if any), DMA continues with free buffer
+            uint32_t interrupts = spin_lock_blocking(capture_statistics_lock);
+            if (received == SPI_BYTE_NUM && overflow == false){
+                capture_stats.frames_received++;
+                if (spi_ready_buffer != SPI_NO_FRAME){
+                    capture_stats.frames_overwritten++;
+                }
+                if (spi_last_frame_time != 0){
+                    add_timing_sample(&capture_stats.frame_interval, isr_start - spi_last_frame_time);
+                }
+                spi_last_frame_time = isr_start;
+
+                spi_frame_hashes[spi_dma_buffer] = dma_hw->sniff_data;
+                spi_frame_times[spi_dma_buffer] = isr_start;
+                spi_ready_buffer = spi_dma_buffer;
+                spi_dma_buffer = get_free_spi_buffer();
+                post_event(EVENT_SPI_FRAME);
+
+                spi_recv_last_seen_time = isr_start;
+                uint32_t input_interrupts = lock_input_data();
+                input_data.spi_recv_running = true;
+                unlock_input_data(input_interrupts, isr_start);
+            }
+            else {
+                capture_stats.frames_dropped++;
+            }
+            arm_spi_dma();
+            add_timing_sample(&capture_stats.isr_duration, time_us_32() - isr_start);
+            spin_unlock(capture_statistics_lock, interrupts);
+        }
 
-    //Handler for +5V Power detection
-    if (gpio_get(POWER_5V_PIN) == 1 && input_data.powered_on == false){
-        input_data.powered_on = true;  
+        update_pio_machines_state();
     }
-    if (gpio_get(POWER_5V_PIN) == 0 && input_data.powered_on == true){
-        input_data.powered_on = false;  
+    LATENCY_END(LATENCY_SITE_PIO0_IRQ0, start);
+}
+
+
+
+
+
+//Command channel
+/**
+ * @brief Parses and executes received commands.
+ */
+void parse_commands(){
+    //Unable to push when reg_handler does not run
+    uint32_t interrupts = lock_input_data();
+    if (input_data.reg_handler_running == false && command_data.buttons > 0){
+        input_data.button_push_failed = true;
     }
-    
+    unlock_input_data(interrupts, time_us_32());
 
-    //Handler for Red Screen detection
-    if (gpio_get(SCREEN_RED_PIN) == 1 && input_data.red_screen == false){
-        input_data.red_screen = true; 
+    //Button push timer reset
+    if (push_button_timer != -1){
+        cancel_alarm(push_button_timer);
     }
-    if (gpio_get(SCREEN_RED_PIN) == 0 && input_data.red_screen == true){
-        input_data.red_screen = false; 
+    //Button pushing
+    gpio_put(POWER_BUTTON_CONTROL, command_data.power_button_push);
+    //Sets alarm to release pushed buttons
+    if ((command_data.buttons > 0 || command_data.power_button_push == true) && command_data.button_clear_disabled == false){
+        push_button_timer = add_alarm_in_us(PUSH_BUTTON_DURATION, push_button_timer_callback, NULL, false);
     }
 
+}
 
-    //Handler for Green Screen detection
-    if (gpio_get(SCREEN_WHITE_PIN) == 1 && input_data.white_screen == false){
-        input_data.white_screen = true;
-        
-    }
-    if (gpio_get(SCREEN_WHITE_PIN) == 0 && input_data.white_screen == true){
-        (SCREEN_WHITE_PIN, GPIO_IRQ_EDGE_FALL);
-        input_data.white_screen = false; 
+/**
+ * @brief Handler for multicore FIFO interrupt (doorbell from core1).
+ * 
+ * Executes all commands waiting in FIFO and acknowledges them by their sequence number.
+ */
+void __time_critical_func(sio_irq_proc0_handler)(){
+    while (multicore_fifo_rvalid()){
+        uint32_t word = multicore_fifo_pop_blocking();
+        command_data.raw_data = command_fifo_value(word);
+        parse_commands();
+        command_completed_sequence = command_fifo_sequence(word);
     }
+    multicore_fifo_clear_irq();
+}
 
 
-    //If screen is lighting, start PIO machines
-    if ((gpio_get(SCREEN_RED_PIN) == 1 || gpio_get(SCREEN_WHITE_PIN) == 1)){
-        if (spi_sm_started == false){
-            start_spi_receiver();
-            spi_sm_started = true;
-        }
-        if (reg_sm_started == false){
-            start_reg_handler();
-            reg_sm_started = true;
-        }
+
+
+
+//Macro engine
+/**
+ * @brief Releases all buttons pushed by macro.
+ */
+void release_macro_buttons(){
+    command_data.buttons = 0;
+    command_data.power_button_push = false;
+    parse_commands();
+}
+
+/**
+ * @brief Ends running macro and restores command settings of host.
+ * 
+ * @param state Final state of macro
+ */
+void finish_macro(uint16_t state){
+    release_macro_buttons();
+    command_data.button_clear_disabled = macro_saved_clear_disabled;
+    macro_state = state;
+}
+
+/**
+ * @brief Checks condition of macro step against the latest screen snapshot.
+ * 
+ * @param step Current step
+ * @return True if condition is met, false otherwise (always false for MACRO_CONDITION_NONE).
+ */
+bool check_macro_condition(volatile macro_step* step){
+    volatile screen_snapshot* latest = &screen_snapshots[screen_latest_snapshot];
+    uint32_t parameter = ((uint32_t)step->parameter_high << 16) | step->parameter_low;
+    switch (step->condition){
+        case MACRO_CONDITION_FRAME_CHANGED:
+            return latest->frame_hash != macro_start_hash;
+        case MACRO_CONDITION_PAGES_CHANGED:
+            for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+                if ((parameter & (1u << page)) && latest->page_versions[page] != macro_start_page_versions[page]){
+                    return true;
+                }
+            }
+            return false;
+        case MACRO_CONDITION_SCREEN_ID:
+            return latest->classification.screen_id == parameter;
+        case MACRO_CONDITION_FRAME_HASH:
+            return latest->frame_hash == parameter;
+        default:
+            return false;
     }
+}
 
-    //If screen does not light, stop PIO machines
-    if ((gpio_get(SCREEN_RED_PIN) == 0 && gpio_get(SCREEN_WHITE_PIN) == 0)){
-        if (spi_sm_started == true){
-            reset_spi_receiver();
-            spi_sm_started = false;
+/**
+ * @brief Periodic callback of macro engine, executes one phase of current step.
+ * 
+ * Step starts by push of buttons (their state is captured at the same moment), 
+ * buttons are released after push time and then engine waits for condition of the step.
+ * If the condition is not met until timeout, step is repeated.
+ * @param id Not used
+ * @param user_data Not used
+ * @return Time to the next tick, 0 when macro ended
+ */
+int64_t __time_critical_func(macro_tick_callback)(alarm_id_t id, __unused void *user_data){
+    LATENCY_START(start);
+    if (macro_abort_request == true){
+        finish_macro(MACRO_ABORTED);
+        LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+        return 0;
+    }
+
+    volatile macro_step* step = &macro_steps[macro_current_step];
+    uint32_t phase_time_us = time_us_32() - macro_phase_start_time;
+    switch (macro_phase){
+        case MACRO_PHASE_PUSH: {
+            volatile screen_snapshot* latest = &screen_snapshots[screen_latest_snapshot];
+            macro_start_hash = latest->frame_hash;
+            for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+                macro_start_page_versions[page] = latest->page_versions[page];
+            }
+            if (step->command != 0){
+                command_data.raw_data = step->command;
+                command_data.button_clear_disabled = true;
+                parse_commands();
+            }
+            macro_phase = MACRO_PHASE_RELEASE;
+            macro_phase_start_time = time_us_32();
+            break;
         }
-        if (reg_sm_started == true){
-            reset_reg_handler();
-            reg_sm_started = false;
+
+        case MACRO_PHASE_RELEASE:
+            if (phase_time_us >= step->push_ms * 1000u){
+                release_macro_buttons();
+                macro_phase = MACRO_PHASE_WAIT;
+                macro_phase_start_time = time_us_32();
+            }
+            break;
+
+        case MACRO_PHASE_WAIT: {
+            bool timeout = phase_time_us >= step->timeout_ms * 1000u;
+            if (check_macro_condition(step) == true || (timeout == true && step->condition == MACRO_CONDITION_NONE)){
+                macro_repetition = 0;
+                macro_phase = MACRO_PHASE_PUSH;
+                if (++macro_current_step >= macro_step_num){
+                    finish_macro(MACRO_DONE);
+                    LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+                    return 0;
+                }
+            }
+            else if (timeout == true){
+                if (macro_repetition >= step->repeat_num){
+                    finish_macro(MACRO_FAILED);
+                    LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+                    return 0;
+                }
+                macro_repetition++;
+                macro_phase = MACRO_PHASE_PUSH;
+            }
+            break;
         }
     }
+    LATENCY_END(LATENCY_SITE_ALARM_CALLBACK, start);
+    return MACRO_TICK_US;
+}
 
+/**
+ * @brief Starts uploaded macro. Called by core1, engine itself runs in alarm callbacks on core0.
+ * 
+ * @param step_num Number of steps to execute
+ * @return False if macro is already running, true otherwise.
+ */
+bool start_macro(uint16_t step_num){
+    if (macro_state == MACRO_RUNNING){
+        return false;
+    }
+    macro_step_num = step_num;
+    macro_current_step = 0;
+    macro_repetition = 0;
+    macro_phase = MACRO_PHASE_PUSH;
+    macro_abort_request = false;
+    macro_saved_clear_disabled = command_data.button_clear_disabled;
+    macro_state = MACRO_RUNNING;
+
+    //Default alarm pool belongs to core0, so the callback runs there
+    if (add_alarm_in_us(MACRO_TICK_US, macro_tick_callback, NULL, false) <= 0){
+        macro_state = MACRO_FAILED;
+    }
+    return true;
 }
 
 
@@ -473,26 +947,33 @@ void controller_init(){
     spi_sm_offset = pio_add_program(pio0, &spi_recv_program);
     spi_recv_program_init(SPI_PIO, SPI_SM, spi_sm_offset, SPI_CLKDIV);
 
+    // Set up a PIO state machine to detect frame boundaries, it runs all the time
+    spi_frame_sm_offset = pio_add_program(pio0, &spi_frame_program);
+    spi_frame_program_init(SPI_PIO, SPI_FRAME_SM, spi_frame_sm_offset, SPI_CLKDIV);
+
     // Set up a PIO state machine to read and write to register
     reg_sm_offset = pio_add_program(pio0, &reg_handler_program);
     reg_handler_program_init(REG_PIO, REG_SM, reg_sm_offset, REG_CLKDIV);
 
-    // Configure a channel to read the same word (32 bits) repeatedly from PIO0
-    // SM0's RX FIFO, paced by the data request signal from that peripheral.
+    // Configure a channel to read the lowest byte of PIO0 SM0's RX FIFO repeatedly,
+    // paced by the data request signal from that peripheral.
     dma_channel_spi_read = dma_claim_unused_channel(true);
     dma_config_spi_read = dma_channel_get_default_config(dma_channel_spi_read);
-    channel_config_set_transfer_data_size(&dma_config_spi_read, DMA_SIZE_32);
+    channel_config_set_transfer_data_size(&dma_config_spi_read, DMA_SIZE_8);
     channel_config_set_read_increment(&dma_config_spi_read, false);
     channel_config_set_write_increment(&dma_config_spi_read, true);
     channel_config_set_dreq(&dma_config_spi_read, DREQ_PIO0_RX0);
     dma_channel_configure(
         dma_channel_spi_read,
         &dma_config_spi_read,
-        spi_rx_buffer_dma, 
+        spi_frame_buffers[spi_dma_buffer], 
         &SPI_PIO->rxf[SPI_SM],          
         SPI_BYTE_NUM, 
         false             // Don't start yet
     );
+    //Every received frame is hashed on the fly
+    dma_sniffer_enable(dma_channel_spi_read, DMA_SNIFF_CTRL_CALC_VALUE_CRC32, true);
+    dma_hw->sniff_data = SPI_FRAME_HASH_SEED;
     
     //Configures dma channel to read register data
     dma_channel_reg_read = dma_claim_unused_channel(true);
@@ -531,13 +1012,29 @@ void controller_init(){
 
 
     // Tell the DMA to raise IRQ line 0 when the channel finishes a block
-    dma_channel_set_irq0_enabled(dma_channel_spi_read, true);
     dma_channel_set_irq0_enabled(dma_channel_reg_read, true);
     dma_channel_set_irq0_enabled(dma_channel_reg_write, true);
     // Configure the processor to run dma_handler() when DMA IRQ 0 is asserted
     irq_set_exclusive_handler(DMA_IRQ_0, dma_irq0_handler);
     irq_set_enabled(DMA_IRQ_0, true);
 
+    //End of SPI frame is signalized by PIO interrupt
+    irq_set_exclusive_handler(PIO0_IRQ_0, pio0_irq0_handler);
+    irq_set_enabled(PIO0_IRQ_0, true);
+    pio_sm_set_enabled(SPI_PIO, SPI_FRAME_SM, true);
+
+    //Commands from core1 are received through multicore FIFO
+    multicore_fifo_drain();
+    multicore_fifo_clear_irq();
+    irq_set_exclusive_handler(SIO_IRQ_PROC0, sio_irq_proc0_handler);
+    irq_set_enabled(SIO_IRQ_PROC0, true);
+
+
+    //Initial state of status inputs, later changes are debounced in interrupts
+    init_status_inputs();
+
+    //Timeouts of SPI, REG and standby LED
+    add_alarm_in_us(WATCHDOG_SERVICE_PERIOD_US, watchdog_service_callback, NULL, false);
 
     //Configures interrupts from pins
     gpio_set_irq_callback(gpio_irq_handler);
@@ -545,6 +1042,9 @@ void controller_init(){
 
     gpio_set_irq_enabled(STANDBY_LED_PIN, GPIO_IRQ_EDGE_RISE, true);
     gpio_set_irq_enabled(POWER_BUTTON_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+    gpio_set_irq_enabled(POWER_5V_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+    gpio_set_irq_enabled(SCREEN_RED_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
+    gpio_set_irq_enabled(SCREEN_WHITE_PIN, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL, true);
 
 }
 
@@ -554,36 +1054,111 @@ void controller_init(){
 
 //Data parsers 
 /**
- * @brief Parses received SPI data into single consecutive stream for modbus registers.
+ * @brief Stores published frame into screen history ring.
+ * 
+ * Counter is incremented only after the entry is complete, so the reader
+ * can detect that history was modified during reading. Ring has one slot more
+ * than is published, so the entry being written is never the one being read.
+ * @param snapshot Published snapshot
+ * @param timestamp_us Capture time of the frame
+ */
+void record_screen_history(volatile screen_snapshot* snapshot, uint32_t timestamp_us){
+    volatile screen_history_entry* entry = &screen_history[screen_history_count % SCREEN_HISTORY_SLOT_NUM];
+    entry->timestamp_us = timestamp_us;
+    entry->frame_hash = snapshot->frame_hash;
+    entry->sequence = (uint16_t)(screen_history_count + 1);
+    entry->screen_id = snapshot->classification.screen_id;
+    __dmb();
+    screen_history_count++;
+}
+
+/**
+ * @brief Finds snapshot which is neither the latest one, nor pinned by reader.
+ * 
+ * Reader pins only the latest snapshot (and checks it afterwards), so the returned
+ * snapshot cannot become pinned until it is published.
+ * @return Index of free snapshot
  */
-void parse_spi_data(){
-    int iterator_8bit = 0;
-    for (int i = 0; i < (SPI_BYTE_NUM + 1) / 2; ++i){
-        uint16_t val = spi_rx_buffer[iterator_8bit++] | (spi_rx_buffer[iterator_8bit++] << 8);
-        spi_parsed_data.spi_raw_buffer[i] = endianity_swap_16bit(val);
+int get_free_snapshot(){
+    int pinned = screen_pinned_snapshot;
+    for (int i = 0; i < SCREEN_SNAPSHOT_NUM; ++i){
+        if (i != screen_latest_snapshot && i != pinned){
+            return i;
+        }
     }
+    return SCREEN_SNAPSHOT_NUM - 1;
 }
 
 /**
- * @brief Parses and executes received commands.
+ * @brief Takes the newest complete SPI frame, decodes it into screen framebuffer
+ * and publishes it also as single consecutive stream for modbus registers.
+ * 
+ * Bytes are already packed by DMA, so raw data are only copied (byte order
+ * for registers is handled when the response is built). The frame buffer is
+ * owned by parser until it is published, so DMA never writes into it.
+ * Frames are compared by their hash, only changed frames are decoded and 
+ * version of every page whose content changed is incremented after the update.
+ * Changed screen is then classified against screen templates, as well as unchanged screen 
+ * when red screen changed (error templates depend on it). Malformed frames are dropped.
+ * The frame is built in a free snapshot (starting as copy of the latest one) and
+ * published by switching the latest snapshot index, so reader never sees partial update.
+ * @return True if the frame differs from the published one, false otherwise.
  */
-void parse_commands(){
-    //Unable to push when reg_handler does not run
-    if (input_data.reg_handler_running == false && command_data.buttons > 0){
-        input_data.button_push_failed = true;
+bool parse_spi_data(){
+    uint32_t interrupts = save_and_disable_interrupts();
+    spi_parsed_buffer = spi_ready_buffer;
+    spi_ready_buffer = SPI_NO_FRAME;
+    restore_interrupts(interrupts);
+
+    volatile screen_snapshot* latest = &screen_snapshots[screen_latest_snapshot];
+    //Identical frame is classified again only if red screen changed
+    bool red_screen = input_data.red_screen;
+    if (spi_frame_hashes[spi_parsed_buffer] == latest->frame_hash && latest->classification.red_screen == red_screen){
+        count_capture_event(&capture_stats.frames_identical);
+        spi_parsed_buffer = SPI_NO_FRAME;
+        return false;
     }
 
-    //Button push timer reset
-    if (push_button_timer != -1){
-        cancel_alarm(push_button_timer);
+    int target = get_free_snapshot();
+    volatile screen_snapshot* snapshot = &screen_snapshots[target];
+    memcpy((void*)&snapshot->screen, (const void*)&latest->screen, sizeof(screen_framebuffer));
+    memcpy((void*)snapshot->page_versions, (const void*)latest->page_versions, sizeof(snapshot->page_versions));
+    snapshot->classification = latest->classification;
+
+    volatile uint8_t* frame = spi_frame_buffers[spi_parsed_buffer];
+    uint8_t changed_pages = 0;
+    if (decode_screen_frame(frame, SPI_BYTE_NUM, &snapshot->screen, &changed_pages) == false){
+        count_capture_event(&capture_stats.frames_malformed);
+        spi_parsed_buffer = SPI_NO_FRAME;
+        return false;
     }
-    //Button pushing
-    gpio_put(POWER_BUTTON_CONTROL, command_data.power_button_push);
-    //Sets alarm to release pushed buttons
-    if ((command_data.buttons > 0 || command_data.power_button_push == true) && command_data.button_clear_disabled == false){
-        push_button_timer = add_alarm_in_us(PUSH_BUTTON_DURATION, push_button_timer_callback, NULL, false);
+
+    memcpy((void*)snapshot->raw.spi_raw_bytes, (const void*)frame, SPI_BYTE_NUM);
+    snapshot->frame_hash = spi_frame_hashes[spi_parsed_buffer];
+    for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+        if (changed_pages & (1u << page)){
+            snapshot->page_versions[page]++;
+        }
     }
 
+    if (changed_pages != 0 || snapshot->classification.red_screen != red_screen){
+        screen_classification result;
+        classify_screen(&snapshot->screen, red_screen, &result);
+        snapshot->classification = result;
+    }
+    snapshot->generation = latest->generation + 1;
+
+    //Snapshot must be complete before it is published
+    __dmb();
+    screen_latest_snapshot = target;
+    record_screen_history(snapshot, spi_frame_times[spi_parsed_buffer]);
+
+    interrupts = spin_lock_blocking(capture_statistics_lock);
+    capture_stats.frames_published++;
+    add_timing_sample(&capture_stats.publish_latency, time_us_32() - spi_frame_times[spi_parsed_buffer]);
+    spin_unlock(capture_statistics_lock, interrupts);
+    spi_parsed_buffer = SPI_NO_FRAME;
+    return true;
 }
 
 
@@ -591,33 +1166,36 @@ void parse_commands(){
 
 /**
  * @brief Main controller loop
+ * 
+ * Core sleeps until event is posted or interrupt arrives, then handles posted events.
+ * Input register is modified only by interrupts (which wake the core) and core1 (which
+ * posts EVENT_HOST_READ), so it is compared after every wake up.
  */
 int main(){
     stdio_init_all();
+    LATENCY_INIT();
+    capture_statistics_lock = spin_lock_init(spin_lock_claim_unused(true));
+    input_data_lock = spin_lock_init(spin_lock_claim_unused(true));
     multicore_launch_core1(communication_loop);
 
     controller_init();
 
     while(true){ 
+        if (take_event(EVENT_SPI_FRAME) == true && spi_ready_buffer != SPI_NO_FRAME){
+            parse_spi_data();
+        }
+        take_event(EVENT_HOST_READ);
+
         if (last_input_data.raw_data != input_data.raw_data){
             last_input_data.raw_data = input_data.raw_data;
             unread_input_data = true;
         }
-        if (spi_new_data == true  && spi_lock_data == false){
-            parse_spi_data();
-            spi_new_data = false;
-            unread_screen_data = true;
-        }
-        if (command_update_request == true){
-            parse_commands();            
-            command_update_request = false;
-        }
-
-        detect_status();
-
-        gpio_put(NEW_DATA_SIGNAL, unread_input_data | unread_screen_data);
-        sleep_us(10);
+        //Screen is unread until host pins the latest snapshot
+        gpio_put(NEW_DATA_SIGNAL, unread_input_data | (screen_pinned_snapshot != screen_latest_snapshot));
 
+        if (is_event_pending() == false){
+            __wfe();
+        }
     }
 }
 
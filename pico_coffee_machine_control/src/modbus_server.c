@@ -7,46 +7,52 @@
 //Address of SPI register read in previous operation
 uint16_t last_read_SPI_register = 0;
 
-//Precalculated CRC table
-static const uint16_t crc_table[256] = {
-	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
-	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
-	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
-	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
-	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
-	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
-	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
-	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
-	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
-	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
-	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
-	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
-	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
-	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
-	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
-	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
-	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
-	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
-	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
-	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
-	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
-	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
-	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
-	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
-	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
-	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
-	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
-	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
-	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
-	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
-	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
-	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040 };
+//Versions of screen pages as they were last read by host
+uint16_t host_page_versions[SCREEN_PAGE_NUM] = {0};
+
+//Sequence of the last command sent to core0
+volatile uint16_t command_issued_sequence = 0;
+
+//Compressed screen transfer
+uint8_t sent_screen[SCREEN_BYTE_NUM] = {0};     //Screen encoded in the last compressed block
+uint8_t acked_screen[SCREEN_BYTE_NUM] = {0};    //Base of delta, acknowledged by host
+uint16_t sent_screen_tag = 0;
+uint16_t acked_screen_tag = 0;                  //0 means empty base screen
+uint8_t compressed_block[SCREEN_COMPRESSED_REGISTER_NUM * 2] = {0};
 
 //For this core, other than default alarm pool must be used
 volatile alarm_id_t onboard_led_timer = -1;
-volatile alarm_id_t spi_registers_read_timer = -1;
+volatile alarm_id_t baud_rate_confirm_timer = -1;
 struct alarm_pool* p1 = NULL;
 
+//Frame receiving, frames are filled by UART interrupt and closed by t3.5 alarm
+modbus_rx_frame rx_frames[MODBUS_RX_FRAME_NUM] = {0};
+volatile int rx_receiving_frame = 0;
+volatile int rx_ready_frame = MODBUS_NO_FRAME;
+volatile uint32_t rx_last_char_time = 0;
+int rx_frame_alarm = -1;
+volatile uint32_t request_end_time = 0; //End of the request being answered (latency measurement)
+
+//Response transmitting, DMA sends one buffer while the next response is prepared
+uint8_t tx_buffers[MODBUS_TX_BUFFER_NUM][MAX_RESPONSE_LENGTH + CRC_LEN] = {0};
+uint16_t tx_lengths[MODBUS_TX_BUFFER_NUM] = {0};
+uint32_t tx_request_end_times[MODBUS_TX_BUFFER_NUM] = {0}; //End of request answered by buffer (latency measurement)
+volatile int tx_sending_buffer = MODBUS_NO_FRAME;
+volatile int tx_pending_buffer = MODBUS_NO_FRAME;
+int dma_channel_uart_tx = -1;
+dma_channel_config dma_config_uart_tx;
+
+//Frame timing (in us), calculated from baud rate
+uint32_t modbus_char_time_us = 0;
+uint32_t modbus_t15_us = 0;
+uint32_t modbus_t35_us = 0;
+
+//Baud rate switching, new baud rate is applied after response is sent and must be confirmed by host
+uint32_t modbus_baud_rate = MODBUS_UART_BAUD_RATE;
+uint32_t confirmed_baud_rate = MODBUS_UART_BAUD_RATE;
+bool baud_rate_change_pending = false;
+volatile bool baud_rate_revert_request = false;
+
 /**
  * @brief Calculates CRC for MODBUS message.
  * 
@@ -58,15 +64,7 @@ struct alarm_pool* p1 = NULL;
  */
 bool calculate_crc(volatile uint8_t* packet_data, uint16_t length, bool response)
 {
-	uint8_t xor = 0;
-	uint16_t crc = 0xFFFF;
-
-	for (int i = 0; i < length; ++i)
-	{
-		xor = packet_data[i] ^ crc;
-		crc >>= 8;
-		crc ^= crc_table[xor];
-	}
+	uint16_t crc = modbus_crc(packet_data, length);
 
 	if (response){
         //Stores CRC at the end of packet
@@ -79,6 +77,22 @@ bool calculate_crc(volatile uint8_t* packet_data, uint16_t length, bool response
 }
 
 
+/**
+ * @brief Copies raw bytes into response buffer as registers.
+ * 
+ * Payload is transmitted "as is", so bytes in each register are swapped
+ * to reach the host in the same order as they have been received.
+ * @param buffer Response buffer
+ * @param offset Position of first register in buffer
+ * @param data Raw bytes
+ * @param register_count Number of registers to copy (2 bytes each)
+ */
+void put_bytes_as_registers(uint8_t* buffer, uint16_t offset, volatile uint8_t* data, uint16_t register_count){
+    for (int i = 0; i < register_count * 2; i += 2){
+        buffer[offset + i] = data[i + 1];
+        buffer[offset + i + 1] = data[i];
+    }
+}
 
 
 
@@ -96,19 +110,17 @@ int64_t __time_critical_func(onboard_led_time_callback)(alarm_id_t id, __unused
 }
 
 /**
- * @brief Timeout for SPI registers transmission
+ * @brief Timeout for confirmation of new baud rate
  * 
- * SPI data remain locked until all 5 register groups are read.
- * In case the transmission fails, SPI reading must be unlocked by timer.
+ * Host did not send any valid request at new baud rate, so the last
+ * confirmed baud rate is restored (by communication loop).
  * @param id Not used
  * @param user_data Not used
  * @return 0
  */
-int64_t __time_critical_func(spi_lock_data_timeout_callback)(alarm_id_t id, __unused void *user_data){
-    
-    spi_registers_read_timer = -1;
-    spi_lock_data = false;
-    //last_read_SPI_register = 0; Not necessary
+int64_t __time_critical_func(baud_rate_confirm_timeout_callback)(alarm_id_t id, __unused void *user_data){
+    baud_rate_confirm_timer = -1;
+    baud_rate_revert_request = true;
     return 0;
 }
 
@@ -118,15 +130,66 @@ int64_t __time_critical_func(spi_lock_data_timeout_callback)(alarm_id_t id, __un
 
 
 //Response senders
+/**
+ * @brief Starts DMA transmission of response buffer
+ * 
+ * @param buffer Index of buffer in tx_buffers
+ */
+void __time_critical_func(start_response_transmission)(int buffer){
+    LATENCY_RECORD(LATENCY_SITE_MODBUS_RESPONSE, time_us_32() - tx_request_end_times[buffer]);
+    tx_sending_buffer = buffer;
+    dma_channel_transfer_from_buffer_now(dma_channel_uart_tx, tx_buffers[buffer], tx_lengths[buffer]);
+}
+
 /**
  * @brief Sends response to received Modbus packet
  * 
+ * Response is copied into free transmit buffer and sent by DMA, so the function
+ * returns immediately. It waits only if both buffers are occupied.
+ * Over USB, response is sent with MBAP header instead of CRC.
  * @param packet_data Modbus packet in form of raw data
  * @param length Length of packet (in bytes, excluding CRC)
  */
 void send_response(volatile uint8_t* packet_data, uint16_t length){
+#ifdef MODBUS_USB_TRANSPORT
+    LATENCY_RECORD(LATENCY_SITE_MODBUS_RESPONSE, time_us_32() - request_end_time);
+    usb_send_frame(packet_data, length);
+#else
     calculate_crc(packet_data, length, true);
-    uart_write_blocking(MODBUS_UART, (const uint8_t*)packet_data, length + CRC_LEN);
+
+    while (tx_pending_buffer != MODBUS_NO_FRAME){
+        __wfe();
+    }
+    int buffer = (tx_sending_buffer + 1) % MODBUS_TX_BUFFER_NUM;
+    memcpy(tx_buffers[buffer], (const void*)packet_data, length + CRC_LEN);
+    tx_lengths[buffer] = length + CRC_LEN;
+    tx_request_end_times[buffer] = request_end_time;
+
+    uint32_t interrupts = save_and_disable_interrupts();
+    if (tx_sending_buffer == MODBUS_NO_FRAME){
+        start_response_transmission(buffer);
+    }
+    else {
+        tx_pending_buffer = buffer;
+    }
+    restore_interrupts(interrupts);
+#endif
+}
+
+/**
+ * @brief Interrupt handler for DMA IRQ 1 (core1)
+ * @section dma_channel_uart_tx: Fired when response was passed to UART, pending response (if any) is started.
+ */
+void __time_critical_func(dma_irq1_handler)(){
+    if (dma_hw->ints1 & (1u << dma_channel_uart_tx)){
+        dma_hw->ints1 = 1u << dma_channel_uart_tx;
+
+        tx_sending_buffer = MODBUS_NO_FRAME;
+        if (tx_pending_buffer != MODBUS_NO_FRAME){
+            start_response_transmission(tx_pending_buffer);
+            tx_pending_buffer = MODBUS_NO_FRAME;
+        }
+    }
 }
 
 /**
@@ -144,6 +207,338 @@ void send_error_response(volatile request_packet* packet, uint8_t error_code){
 
 
 
+//Screen snapshots
+/**
+ * @brief Pins the latest screen snapshot, so it is not overwritten by core0 while being read.
+ * 
+ * Index is checked again after pinning, because core0 could have selected the pinned
+ * snapshot as free one before it noticed the pin.
+ * @return Pinned snapshot
+ */
+volatile screen_snapshot* pin_latest_snapshot(){
+    int latest;
+    do {
+        latest = screen_latest_snapshot;
+        screen_pinned_snapshot = latest;
+        __dmb();
+    } while (latest != screen_latest_snapshot);
+    post_event(EVENT_HOST_READ);
+    return &screen_snapshots[latest];
+}
+
+/**
+ * @brief Gets snapshot pinned by the last pin_latest_snapshot() call.
+ * 
+ * @return Pinned snapshot
+ */
+volatile screen_snapshot* get_pinned_snapshot(){
+    return &screen_snapshots[screen_pinned_snapshot];
+}
+
+
+
+
+
+//Compressed screen transfer
+/**
+ * @brief Encodes screen of pinned snapshot into compressed block (delta against acknowledged screen).
+ */
+void encode_compressed_block(){
+    memcpy(sent_screen, (const void*)get_pinned_snapshot()->screen.pixels, SCREEN_BYTE_NUM);
+    //Tag 0 is reserved for empty base screen
+    if (++sent_screen_tag == 0){
+        sent_screen_tag = 1;
+    }
+
+    uint16_t length = compress_screen(sent_screen, acked_screen, compressed_block + SCREEN_COMPRESSED_HEADER_REGISTER_NUM * 2);
+    put_16bit_into_byte_buffer(compressed_block, 0, sent_screen_tag);
+    put_16bit_into_byte_buffer(compressed_block, 2, acked_screen_tag);
+    put_16bit_into_byte_buffer(compressed_block, 4, length);
+    put_16bit_into_byte_buffer(compressed_block, 6, modbus_crc(sent_screen, SCREEN_BYTE_NUM));
+}
+
+/**
+ * @brief Acknowledges screen received by host, which becomes base for next delta.
+ * 
+ * @param tag Tag of received screen, 0 resets base to empty screen
+ * @return True if screen was acknowledged, false if tag does not match the last sent screen.
+ */
+bool acknowledge_screen(uint16_t tag){
+    if (tag == 0){
+        memset(acked_screen, 0, SCREEN_BYTE_NUM);
+    }
+    else if (tag == sent_screen_tag){
+        memcpy(acked_screen, sent_screen, SCREEN_BYTE_NUM);
+    }
+    else {
+        return false;
+    }
+    acked_screen_tag = tag;
+    return true;
+}
+
+
+
+
+
+//Register getters
+/**
+ * @brief Gets bitmap of screen pages which changed since host read them last time.
+ * 
+ * @return Bit n is set if page n changed
+ */
+uint16_t get_changed_pages(){
+    volatile screen_snapshot* snapshot = get_pinned_snapshot();
+    uint16_t changed_pages = 0;
+    for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+        if (snapshot->page_versions[page] != host_page_versions[page]){
+            changed_pages |= 1u << page;
+        }
+    }
+    return changed_pages;
+}
+
+/**
+ * @brief Gets value of single status register
+ * 
+ * @param address Address of register
+ * @return Value of register
+ */
+uint16_t get_status_register(uint16_t address){
+    volatile screen_snapshot* snapshot = get_pinned_snapshot();
+    switch (address){
+        case INPUT_REGISTER_ADDRESS:
+            return input_data.raw_data;
+        case SCREEN_CHANGED_PAGES_REGISTER_ADDRESS:
+            return get_changed_pages();
+        case SCREEN_FRAME_HASH_REGISTER_ADDRESS:
+            return snapshot->frame_hash >> 16;
+        case SCREEN_FRAME_HASH_REGISTER_ADDRESS + 1:
+            return snapshot->frame_hash & 0xffff;
+        case SCREEN_ID_REGISTER_ADDRESS:
+            return snapshot->classification.screen_id;
+        case SCREEN_CONFIDENCE_REGISTER_ADDRESS:
+            return snapshot->classification.confidence;
+        case SCREEN_GENERATION_REGISTER_ADDRESS:
+            return snapshot->generation >> 16;
+        case SCREEN_GENERATION_REGISTER_ADDRESS + 1:
+            return snapshot->generation & 0xffff;
+        case COMMAND_ISSUED_SEQUENCE_REGISTER_ADDRESS:
+            return command_issued_sequence;
+        case COMMAND_COMPLETED_SEQUENCE_REGISTER_ADDRESS:
+            return command_completed_sequence;
+        case MACRO_STATE_REGISTER_ADDRESS:
+            return macro_state;
+        case MACRO_CURRENT_STEP_REGISTER_ADDRESS:
+            return macro_current_step;
+        default:
+            if (address >= SCREEN_MATCH_BITMAP_REGISTER_ADDRESS && 
+                address < SCREEN_MATCH_BITMAP_REGISTER_ADDRESS + SCREEN_MATCH_BITMAP_REGISTER_NUM){
+                return snapshot->classification.match_bitmap[address - SCREEN_MATCH_BITMAP_REGISTER_ADDRESS];
+            }
+            return 0;
+    }
+}
+
+
+/**
+ * @brief Copies screen history into register buffer (newest entry first).
+ * 
+ * History is written by core0, so the copy is repeated if a new screen
+ * was recorded during copying.
+ * @param registers Output buffer (SCREEN_HISTORY_REGISTER_NUM registers)
+ */
+void get_screen_history(uint16_t* registers){
+    uint32_t count = 0;
+    do {
+        count = screen_history_count;
+        __dmb();
+        registers[0] = (uint16_t)count;
+        for (uint32_t i = 0; i < SCREEN_HISTORY_LEN; ++i){
+            uint16_t* entry_registers = registers + 1 + i * SCREEN_HISTORY_ENTRY_REGISTER_NUM;
+            if (i >= count){
+                memset(entry_registers, 0, SCREEN_HISTORY_ENTRY_REGISTER_NUM * 2);
+                continue;
+            }
+            volatile screen_history_entry* entry = &screen_history[(count - 1 - i) % SCREEN_HISTORY_SLOT_NUM];
+            entry_registers[0] = entry->sequence;
+            entry_registers[1] = entry->screen_id;
+            entry_registers[2] = entry->frame_hash >> 16;
+            entry_registers[3] = entry->frame_hash & 0xffff;
+            entry_registers[4] = entry->timestamp_us >> 16;
+            entry_registers[5] = entry->timestamp_us & 0xffff;
+        }
+        __dmb();
+    } while (count != screen_history_count);
+}
+
+
+/**
+ * @brief Copies input event log into register buffer (newest entry first).
+ * 
+ * Log is written by core0, so the copy is repeated if a new event
+ * was recorded during copying.
+ * @param registers Output buffer (INPUT_EVENT_LOG_REGISTER_NUM registers)
+ */
+void get_input_event_log(uint16_t* registers){
+    uint32_t count = 0;
+    do {
+        count = input_event_count;
+        __dmb();
+        registers[0] = (uint16_t)count;
+        for (uint32_t i = 0; i < INPUT_EVENT_LOG_LEN; ++i){
+            uint16_t* entry_registers = registers + 1 + i * INPUT_EVENT_ENTRY_REGISTER_NUM;
+            if (i >= count){
+                memset(entry_registers, 0, INPUT_EVENT_ENTRY_REGISTER_NUM * 2);
+                continue;
+            }
+            volatile input_event* entry = &input_event_log[(count - 1 - i) % INPUT_EVENT_SLOT_NUM];
+            entry_registers[0] = entry->sequence;
+            entry_registers[1] = entry->value;
+            entry_registers[2] = entry->timestamp_us >> 16;
+            entry_registers[3] = entry->timestamp_us & 0xffff;
+        }
+        __dmb();
+    } while (count != input_event_count);
+}
+
+
+
+
+//Holding registers
+/**
+ * @brief Checks whether the whole range lies in one block of holding registers.
+ * 
+ * @param first_register Address of the first register
+ * @param register_count Number of registers
+ * @return True if range is valid, false otherwise.
+ */
+bool is_holding_register_range(uint16_t first_register, uint16_t register_count){
+    return (first_register >= HOLDING_REGISTER_ADDRESS && 
+            first_register + register_count <= HOLDING_REGISTER_ADDRESS + HOLDING_REGISTER_NUM) ||
+        (first_register >= MACRO_STEP_REGISTER_ADDRESS && 
+            first_register + register_count <= MACRO_STEP_REGISTER_ADDRESS + MACRO_REGISTER_NUM);
+}
+
+/**
+ * @brief Gets value of single holding register
+ * 
+ * @param address Address of register
+ * @return Value of register
+ */
+uint16_t get_holding_register(uint16_t address){
+    switch (address){
+        case HOLDING_REGISTER_ADDRESS:
+            return command_data.raw_data;
+        case SCREEN_ACK_REGISTER_ADDRESS:
+            return acked_screen_tag;
+        case BAUD_RATE_REGISTER_ADDRESS:
+            return modbus_baud_rate / BAUD_RATE_REGISTER_UNIT;
+        case MACRO_CONTROL_REGISTER_ADDRESS:
+            return macro_step_num;
+        default:
+            if (address >= MACRO_STEP_REGISTER_ADDRESS && address < MACRO_CONTROL_REGISTER_ADDRESS){
+                uint16_t offset = address - MACRO_STEP_REGISTER_ADDRESS;
+                return macro_steps[offset / MACRO_STEP_REGISTER_NUM].registers[offset % MACRO_STEP_REGISTER_NUM];
+            }
+            return 0;
+    }
+}
+
+/**
+ * @brief Writes single holding register. Command is passed to core0 and executed asynchronously,
+ * its completion is reported by sequence number in status registers.
+ * 
+ * @param address Address of register
+ * @param value Written value
+ * @return 0 if register was written, exception code otherwise
+ */
+uint8_t write_holding_register(uint16_t address, uint16_t value){
+    switch (address){
+        case HOLDING_REGISTER_ADDRESS:
+            if (multicore_fifo_push_timeout_us(command_fifo_word(command_issued_sequence + 1, value), COMMAND_FIFO_TIMEOUT_US) == false){
+                return EX_SERVER_BUSY;
+            }
+            command_issued_sequence++;
+            return 0;
+        case SCREEN_ACK_REGISTER_ADDRESS:
+            return acknowledge_screen(value) ? 0 : EX_ILLEGAL_VALUE;
+        case BAUD_RATE_REGISTER_ADDRESS:
+#ifdef MODBUS_USB_TRANSPORT
+            return EX_ILLEGAL_ADDRESS;
+#else
+            if (value * BAUD_RATE_REGISTER_UNIT < MODBUS_MIN_BAUD_RATE || value * BAUD_RATE_REGISTER_UNIT > MODBUS_MAX_BAUD_RATE){
+                return EX_ILLEGAL_VALUE;
+            }
+            //Response is sent at current baud rate, new one is applied afterwards
+            modbus_baud_rate = value * BAUD_RATE_REGISTER_UNIT;
+            baud_rate_change_pending = true;
+            return 0;
+#endif
+        case MACRO_CONTROL_REGISTER_ADDRESS:
+            if (value == 0){
+                macro_abort_request = true;
+                return 0;
+            }
+            if (value > MACRO_MAX_STEP_NUM){
+                return EX_ILLEGAL_VALUE;
+            }
+            return start_macro(value) ? 0 : EX_SERVER_BUSY;
+        default:
+            if (address >= MACRO_STEP_REGISTER_ADDRESS && address < MACRO_CONTROL_REGISTER_ADDRESS){
+                if (macro_state == MACRO_RUNNING){
+                    return EX_SERVER_BUSY;
+                }
+                uint16_t offset = address - MACRO_STEP_REGISTER_ADDRESS;
+                macro_steps[offset / MACRO_STEP_REGISTER_NUM].registers[offset % MACRO_STEP_REGISTER_NUM] = value;
+                return 0;
+            }
+            return EX_ILLEGAL_ADDRESS;
+    }
+}
+
+/**
+ * @brief Waits until core0 executes all issued commands (one FIFO round-trip).
+ * 
+ * @return True if commands were executed, false if COMMAND_COMPLETE_TIMEOUT_US elapsed
+ */
+bool wait_for_command_completion(){
+    uint32_t start_time = time_us_32();
+    while (command_completed_sequence != command_issued_sequence){
+        if (time_us_32() - start_time > COMMAND_COMPLETE_TIMEOUT_US){
+            return false;
+        }
+        tight_loop_contents();
+    }
+    return true;
+}
+
+/**
+ * @brief Writes holding registers from request payload (big endian values).
+ * 
+ * @param first_register Address of the first written register
+ * @param register_count Number of written registers
+ * @param values Payload of request
+ * @return 0 if all registers were written, exception code otherwise
+ */
+uint8_t write_holding_registers(uint16_t first_register, uint16_t register_count, volatile uint8_t* values){
+    if (is_holding_register_range(first_register, register_count) == false){
+        return EX_ILLEGAL_ADDRESS;
+    }
+    for (int i = 0; i < register_count; ++i){
+        uint16_t value = (values[i * 2] << 8) | values[i * 2 + 1];
+        uint8_t error = write_holding_register(first_register + i, value);
+        if (error != 0){
+            return error;
+        }
+    }
+    return 0;
+}
+
+
+
+
+
 //Request handlers
 /**
  * @brief Handles Read_Holding_Registers request and sends response
@@ -152,18 +547,22 @@ void send_error_response(volatile request_packet* packet, uint8_t error_code){
  * @return True if response was sent successfully, false in case of error.
  */
 bool read_holding_registers_handler(volatile request_packet* packet){
-    if (packet->first_register != HOLDING_REGISTER_ADDRESS || packet->register_count != 1){
+    if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+        is_holding_register_range(packet->first_register, packet->register_count) == false){
         send_error_response(packet, EX_ILLEGAL_ADDRESS);
         return false;
     }
 
-    uint8_t mb_response[MODBUS_READ_RESPONSE_BASE_LEN + 2 + CRC_LEN] = {0};
+    uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
     mb_response[0] = packet->address;
     mb_response[1] = packet->function_code;
-    mb_response[2] = 2; //Number of bytes to follow
-    put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, endianity_swap_16bit(command_data.raw_data));
+    mb_response[2] = packet->register_count * 2; //Number of bytes to follow
+    for (int i = 0; i < packet->register_count; ++i){
+        uint16_t value = get_holding_register(packet->first_register + i);
+        put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + i * 2, endianity_swap_16bit(value));
+    }
 
-    send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + 2);
+    send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
     return true;
 }
 
@@ -174,25 +573,230 @@ bool read_holding_registers_handler(volatile request_packet* packet){
  * @return True if response was sent successfully, false in case of error.
  */
 bool read_input_registers_handler(volatile request_packet* packet){
-    //Read input data
-    if (packet->first_register == INPUT_REGISTER_ADDRESS){
+    //Read status registers
+    if (packet->first_register < INPUT_REGISTER_ADDRESS + STATUS_REGISTER_NUM){
         last_read_SPI_register = 0;
 
-        if (packet->register_count != 1){
+        if (packet->register_count == 0 || packet->first_register + packet->register_count > INPUT_REGISTER_ADDRESS + STATUS_REGISTER_NUM){
             send_error_response(packet, EX_ILLEGAL_ADDRESS);
             return false;
         }
         
-        uint8_t mb_response[MODBUS_READ_RESPONSE_BASE_LEN + 2 + CRC_LEN] = {0};
+        uint8_t mb_response[MODBUS_READ_RESPONSE_BASE_LEN + STATUS_REGISTER_NUM * 2 + CRC_LEN] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2; //Number of bytes to follow
+        if (packet->first_register == INPUT_REGISTER_ADDRESS){
+            pin_latest_snapshot();
+        }
+        for (int i = 0; i < packet->register_count; ++i){
+            uint16_t value = get_status_register(packet->first_register + i);
+            put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + i * 2, endianity_swap_16bit(value));
+        }
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        if (packet->first_register == INPUT_REGISTER_ADDRESS){
+            unread_input_data = false;
+            uint32_t interrupts = lock_input_data();
+            input_data.button_push_failed = false;
+            input_data.button_pushed_manually = false;
+            unlock_input_data(interrupts, time_us_32());
+            post_event(EVENT_HOST_READ);
+        }
+        return true;
+    }
+
+    //Read window of screen
+    else if (packet->first_register >= SCREEN_PAGE_REGISTER_ADDRESS && 
+        packet->first_register < SCREEN_PAGE_REGISTER_ADDRESS + SCREEN_REGISTER_NUM){
+        uint16_t offset = packet->first_register - SCREEN_PAGE_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+            offset + packet->register_count > SCREEN_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+
+        //Only pages covered completely by the window are marked as read
+        volatile screen_snapshot* snapshot = get_pinned_snapshot();
+        for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+            uint16_t page_start = page * SCREEN_PAGE_REGISTER_NUM;
+            if (page_start >= offset && page_start + SCREEN_PAGE_REGISTER_NUM <= offset + packet->register_count){
+                host_page_versions[page] = snapshot->page_versions[page];
+            }
+        }
+
+        uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2; //Number of bytes to follow
+        put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, snapshot->screen.pixels + offset * 2, packet->register_count);
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        return true;
+    }
+
+    //Read window of raw SPI frame
+    else if (packet->first_register >= SPI_RAW_REGISTER_ADDRESS && 
+        packet->first_register < SPI_RAW_REGISTER_ADDRESS + SPI_RAW_REGISTER_NUM){
+        uint16_t offset = packet->first_register - SPI_RAW_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+            offset + packet->register_count > SPI_RAW_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+
+        volatile screen_snapshot* snapshot = get_pinned_snapshot();
+        if (offset == 0){
+            for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+                host_page_versions[page] = snapshot->page_versions[page];
+            }
+        }
+
+        uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2; //Number of bytes to follow
+        put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, snapshot->raw.spi_raw_bytes + offset * 2, packet->register_count);
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        return true;
+    }
+
+    //Read screen history
+    else if (packet->first_register >= SCREEN_HISTORY_REGISTER_ADDRESS && 
+        packet->first_register < SCREEN_HISTORY_REGISTER_ADDRESS + SCREEN_HISTORY_REGISTER_NUM){
+        uint16_t offset = packet->first_register - SCREEN_HISTORY_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+            offset + packet->register_count > SCREEN_HISTORY_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+
+        uint16_t history[SCREEN_HISTORY_REGISTER_NUM];
+        get_screen_history(history);
+
+        uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
         mb_response[0] = packet->address;
         mb_response[1] = packet->function_code;
-        mb_response[2] = 2; //Number of bytes to follow
-        put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, endianity_swap_16bit(input_data.raw_data));
+        mb_response[2] = packet->register_count * 2;
+        for (int i = 0; i < packet->register_count; ++i){
+            put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + i * 2, endianity_swap_16bit(history[offset + i]));
+        }
 
-        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + 2);
-        unread_input_data = false;
-        input_data.button_push_failed = false;
-        input_data.button_pushed_manually = false;
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        return true;
+    }
+
+    //Read input event log
+    else if (packet->first_register >= INPUT_EVENT_LOG_REGISTER_ADDRESS && 
+        packet->first_register < INPUT_EVENT_LOG_REGISTER_ADDRESS + INPUT_EVENT_LOG_REGISTER_NUM){
+        uint16_t offset = packet->first_register - INPUT_EVENT_LOG_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+            offset + packet->register_count > INPUT_EVENT_LOG_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+
+        uint16_t log[INPUT_EVENT_LOG_REGISTER_NUM];
+        get_input_event_log(log);
+
+        uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2;
+        for (int i = 0; i < packet->register_count; ++i){
+            put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + i * 2, endianity_swap_16bit(log[offset + i]));
+        }
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        return true;
+    }
+
+    //Read capture statistics
+    else if (packet->first_register >= CAPTURE_STATISTICS_REGISTER_ADDRESS && 
+        packet->first_register < CAPTURE_STATISTICS_REGISTER_ADDRESS + CAPTURE_STATISTICS_REGISTER_NUM){
+        uint16_t offset = packet->first_register - CAPTURE_STATISTICS_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || offset + packet->register_count > CAPTURE_STATISTICS_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+
+        uint32_t values[CAPTURE_STATISTICS_VALUE_NUM];
+        read_capture_statistics(values, offset == 0);
+
+        uint8_t mb_response[MODBUS_READ_RESPONSE_BASE_LEN + CAPTURE_STATISTICS_REGISTER_NUM * 2 + CRC_LEN] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2;
+        for (int i = 0; i < packet->register_count; ++i){
+            uint16_t reg = offset + i;
+            uint16_t value = (reg % 2 == 0) ? values[reg / 2] >> 16 : values[reg / 2] & 0xffff;
+            put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + i * 2, endianity_swap_16bit(value));
+        }
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        return true;
+    }
+
+#ifdef LATENCY_INSTRUMENTATION
+    //Read latency histograms
+    else if (packet->first_register >= LATENCY_HISTOGRAM_REGISTER_ADDRESS && 
+        packet->first_register < LATENCY_HISTOGRAM_REGISTER_ADDRESS + LATENCY_HISTOGRAM_REGISTER_NUM){
+        uint16_t offset = packet->first_register - LATENCY_HISTOGRAM_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+            offset + packet->register_count > LATENCY_HISTOGRAM_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+
+        latency_histogram histograms[LATENCY_SITE_NUM];
+        read_latency_histograms(histograms, offset == 0);
+
+        uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2;
+        for (int i = 0; i < packet->register_count; ++i){
+            uint16_t reg = offset + i;
+            latency_histogram* histogram = &histograms[reg / LATENCY_SITE_REGISTER_NUM];
+            uint16_t index = (reg % LATENCY_SITE_REGISTER_NUM) / 2;
+            uint32_t value = index < LATENCY_BUCKET_NUM ? histogram->buckets[index] : histogram->max;
+            value = (reg % 2 == 0) ? value >> 16 : value & 0xffff;
+            put_16bit_into_byte_buffer(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + i * 2, endianity_swap_16bit(value));
+        }
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
+        return true;
+    }
+#endif
+
+    //Read compressed screen
+    else if (packet->first_register >= SCREEN_COMPRESSED_REGISTER_ADDRESS && 
+        packet->first_register < SCREEN_COMPRESSED_REGISTER_ADDRESS + SCREEN_COMPRESSED_REGISTER_NUM){
+        uint16_t offset = packet->first_register - SCREEN_COMPRESSED_REGISTER_ADDRESS;
+
+        if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM || 
+            offset + packet->register_count > SCREEN_COMPRESSED_REGISTER_NUM){
+            send_error_response(packet, EX_ILLEGAL_ADDRESS);
+            return false;
+        }
+        if (offset == 0){
+            encode_compressed_block();
+        }
+
+        uint8_t mb_response[MAX_RESPONSE_LENGTH] = {0};
+        mb_response[0] = packet->address;
+        mb_response[1] = packet->function_code;
+        mb_response[2] = packet->register_count * 2;
+        put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, compressed_block + offset * 2, packet->register_count);
+
+        send_response(mb_response, MODBUS_READ_RESPONSE_BASE_LEN + packet->register_count * 2);
         return true;
     }
 
@@ -207,48 +811,43 @@ bool read_input_registers_handler(volatile request_packet* packet){
         mb_response[0] = packet->address;
         mb_response[1] = packet->function_code;
         mb_response[2] = MAX_REGISTER_NUM * 2;
+        volatile spi_registers* raw = &get_pinned_snapshot()->raw;
         switch (packet->first_register){
 
             case SPI_INPUT_REGISTER_ADDRESS_G1:
-                if (spi_registers_read_timer != -1){
-                    alarm_pool_cancel_alarm(p1, spi_registers_read_timer);
-                }
-                spi_lock_data = true;
-                spi_registers_read_timer = alarm_pool_add_alarm_in_us(p1, SPI_REGISTERS_READ_TIMEOUT_US, spi_lock_data_timeout_callback, NULL, false);
                 last_read_SPI_register = SPI_INPUT_REGISTER_ADDRESS_G1;
+                //Snapshot stays pinned until the whole screen is read, so all pages are up to date for host
+                raw = &pin_latest_snapshot()->raw;
+                for (int page = 0; page < SCREEN_PAGE_NUM; ++page){
+                    host_page_versions[page] = get_pinned_snapshot()->page_versions[page];
+                }
 
-                memcpy((void*)(mb_response + MODBUS_READ_RESPONSE_BASE_LEN), (const void *)spi_parsed_data.register_group1, MAX_REGISTER_NUM * 2);
+                put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, (volatile uint8_t*)raw->register_group1, MAX_REGISTER_NUM);
                 send_response(mb_response, MAX_REGISTER_NUM * 2 + MODBUS_READ_RESPONSE_BASE_LEN);
                 break;
 
             case SPI_INPUT_REGISTER_ADDRESS_G2:
                 last_read_SPI_register = SPI_INPUT_REGISTER_ADDRESS_G2;
-                memcpy((void*)(mb_response + MODBUS_READ_RESPONSE_BASE_LEN), (const void *)spi_parsed_data.register_group2, MAX_REGISTER_NUM * 2);
+                put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, (volatile uint8_t*)raw->register_group2, MAX_REGISTER_NUM);
                 send_response(mb_response, MAX_REGISTER_NUM * 2 + MODBUS_READ_RESPONSE_BASE_LEN);
                 break;
 
             case SPI_INPUT_REGISTER_ADDRESS_G3:
                 last_read_SPI_register = SPI_INPUT_REGISTER_ADDRESS_G3;
-                memcpy((void*)(mb_response + MODBUS_READ_RESPONSE_BASE_LEN), (const void *)spi_parsed_data.register_group3, MAX_REGISTER_NUM * 2);
+                put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, (volatile uint8_t*)raw->register_group3, MAX_REGISTER_NUM);
                 send_response(mb_response, MAX_REGISTER_NUM * 2 + MODBUS_READ_RESPONSE_BASE_LEN);
                 break;
 
             case SPI_INPUT_REGISTER_ADDRESS_G4:
                 last_read_SPI_register = SPI_INPUT_REGISTER_ADDRESS_G4;
-                memcpy((void*)(mb_response + MODBUS_READ_RESPONSE_BASE_LEN), (const void *)spi_parsed_data.register_group4, MAX_REGISTER_NUM * 2);
+                put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, (volatile uint8_t*)raw->register_group4, MAX_REGISTER_NUM);
                 send_response(mb_response, MAX_REGISTER_NUM * 2 + MODBUS_READ_RESPONSE_BASE_LEN);
                 break;
 
             case SPI_INPUT_REGISTER_ADDRESS_G5:
                 last_read_SPI_register = 0;
-                memcpy((void*)(mb_response + MODBUS_READ_RESPONSE_BASE_LEN), (const void *)spi_parsed_data.register_group5, MAX_REGISTER_NUM * 2);
+                put_bytes_as_registers(mb_response, MODBUS_READ_RESPONSE_BASE_LEN, (volatile uint8_t*)raw->register_group5, MAX_REGISTER_NUM);
                 send_response(mb_response, MAX_REGISTER_NUM * 2 + MODBUS_READ_RESPONSE_BASE_LEN);
-                
-                if (spi_registers_read_timer != -1){
-                    alarm_pool_cancel_alarm(p1, spi_registers_read_timer);
-                }
-                spi_lock_data = false;
-                unread_screen_data = false;
                 break;
 
             default:
@@ -261,29 +860,125 @@ bool read_input_registers_handler(volatile request_packet* packet){
 
 /**
  * @brief Handles Write_Single_Register request, 
- * waits until commands are parsed and sends response.
+ * passes command to core0 and sends response.
  * 
  * @param packet Request packet
  * @return True if response was sent successfully, false in case of error.
  */
 bool write_single_register_handler(volatile request_packet* packet){
-    if (packet->first_register != HOLDING_REGISTER_ADDRESS){
-        send_error_response(packet, EX_ILLEGAL_ADDRESS);
+    uint8_t error = write_holding_register(packet->first_register, packet->single_register_data);
+    if (error != 0){
+        send_error_response(packet, error);
         return false;
     }
 
-    //Waits until command is parsed
-    command_data.raw_data = packet->single_register_data;
-    command_update_request = true;
+    //Command is executed asynchronously, so request is echoed
+    packet->single_register_data = endianity_swap_16bit(packet->single_register_data);
+    packet->first_register = endianity_swap_16bit(packet->first_register);
+    send_response(packet->raw_data, MODBUS_REQUEST_BASE_LENGTH);
+    return true;
+}
+
+/**
+ * @brief Handles Write_Multiple_Registers request, 
+ * passes command to core0 and sends response.
+ * 
+ * @param packet Request packet
+ * @return True if response was sent successfully, false in case of error.
+ */
+bool write_multiple_registers_handler(volatile request_packet* packet){
+    if (packet->register_count == 0 || packet->register_count > MAX_WRITE_REGISTER_NUM ||
+        packet->write_byte_count != packet->register_count * 2){
+        send_error_response(packet, EX_ILLEGAL_VALUE);
+        return false;
+    }
 
-    //Wait for main thread to complete actions
-    while (command_update_request == true);
+    uint8_t error = write_holding_registers(packet->first_register, packet->register_count, 
+        packet->raw_data + WRITE_MULTIPLE_REQUEST_BASE_LENGTH);
+    if (error != 0){
+        send_error_response(packet, error);
+        return false;
+    }
 
-    packet->single_register_data = endianity_swap_16bit(command_data.raw_data);
+    packet->first_register = endianity_swap_16bit(packet->first_register);
+    packet->register_count = endianity_swap_16bit(packet->register_count);
     send_response(packet->raw_data, MODBUS_REQUEST_BASE_LENGTH);
     return true;
 }
 
+/**
+ * @brief Handles Read_Write_Multiple_Registers request. Holding registers are written first,
+ * then input registers are read and sent as response.
+ * 
+ * @param packet Request packet
+ * @return True if response was sent successfully, false in case of error.
+ */
+bool read_write_multiple_registers_handler(volatile request_packet* packet){
+    packet->write_first_register = endianity_swap_16bit(packet->write_first_register);
+    packet->write_register_count = endianity_swap_16bit(packet->write_register_count);
+
+    if (packet->register_count == 0 || packet->register_count > MAX_READ_REGISTER_NUM ||
+        packet->write_register_count == 0 || packet->write_register_count > MAX_READ_WRITE_REGISTER_NUM ||
+        packet->read_write_byte_count != packet->write_register_count * 2){
+        send_error_response(packet, EX_ILLEGAL_VALUE);
+        return false;
+    }
+
+    uint8_t error = write_holding_registers(packet->write_first_register, packet->write_register_count, 
+        packet->raw_data + READ_WRITE_MULTIPLE_REQUEST_BASE_LENGTH);
+    if (error != 0){
+        send_error_response(packet, error);
+        return false;
+    }
+    //Status is read back after the command was executed
+    if (packet->write_first_register == HOLDING_REGISTER_ADDRESS && wait_for_command_completion() == false){
+        send_error_response(packet, EX_SERVER_BUSY);
+        return false;
+    }
+
+    return read_input_registers_handler(packet);
+}
+
+/**
+ * @brief Calculates expected length of request data (address and PDU) from its header.
+ * 
+ * @param data Received data
+ * @param length Length of received data (without CRC)
+ * @return Expected length of request data, 0 if data are too short to tell
+ */
+uint16_t get_request_data_length(volatile uint8_t* data, uint16_t length){
+    if (length < MODBUS_REQUEST_BASE_LENGTH){
+        return 0;
+    }
+    switch (data[1]){
+        case FC_WRITE_MULTIPLE_REGISTERS:
+            return WRITE_MULTIPLE_REQUEST_BASE_LENGTH + data[WRITE_MULTIPLE_REQUEST_BASE_LENGTH - 1];
+        case FC_READ_WRITE_MULTIPLE_REGISTERS:
+            return READ_WRITE_MULTIPLE_REQUEST_BASE_LENGTH + data[READ_WRITE_MULTIPLE_REQUEST_BASE_LENGTH - 1];
+        case FC_READ_HOLDING_REGISTERS:
+        case FC_READ_INPUT_REGISTERS:
+        case FC_WRITE_SINGLE_REGISTER:
+            return MODBUS_REQUEST_BASE_LENGTH;
+        default:
+            //Unknown function, exception is sent
+            return length;
+    }
+}
+
+/**
+ * @brief Calculates expected length of RTU request from its header.
+ * 
+ * @param data Received frame
+ * @param length Length of received frame
+ * @return Expected length of request (including CRC), 0 if frame is too short to tell
+ */
+uint16_t get_request_length(volatile uint8_t* data, uint16_t length){
+    if (length < MODBUS_REQUEST_BASE_LENGTH + CRC_LEN){
+        return 0;
+    }
+    return get_request_data_length(data, length - CRC_LEN) + CRC_LEN;
+}
+
 /**
  * @brief Parses the first part of packet and selects
  * the proper handler according to function code.
@@ -302,12 +997,113 @@ void handle_request(request_packet* packet){
         case FC_WRITE_SINGLE_REGISTER:
             write_single_register_handler(packet);
             break;
+        case FC_WRITE_MULTIPLE_REGISTERS:
+            write_multiple_registers_handler(packet);
+            break;
+        case FC_READ_WRITE_MULTIPLE_REGISTERS:
+            read_write_multiple_registers_handler(packet);
+            break;
         default:
             send_error_response(packet, EX_ILLEGAL_FUNCTION);
     }
 }
 
+/**
+ * @brief Handles valid request and signalizes it by onboard LED.
+ */
+void process_request(request_packet* packet){
+    handle_request(packet);
+    if (onboard_led_timer != -1){
+        alarm_pool_cancel_alarm(p1, onboard_led_timer);
+    }
+    gpio_put(ONBOARD_LED_PIN, 1);
+    onboard_led_timer = alarm_pool_add_alarm_in_us(p1, ONBOARD_LED_TIME_US, onboard_led_time_callback, NULL, false);
+}
+
+
+
+//Frame receiving
+/**
+ * @brief Calculates character time and silent intervals for given baud rate.
+ * 
+ * @param baud_rate Baud rate of UART
+ */
+void set_modbus_timing(uint baud_rate){
+    modbus_char_time_us = (BITS_PER_BYTE * 1000000 + baud_rate - 1) / baud_rate;
+    if (baud_rate > MODBUS_FIXED_TIMING_BAUD_RATE){
+        modbus_t15_us = MODBUS_FIXED_T15_US;
+        modbus_t35_us = MODBUS_FIXED_T35_US;
+    }
+    else {
+        modbus_t15_us = (15 * BITS_PER_BYTE * 1000000 + 10 * baud_rate - 1) / (10 * baud_rate);
+        modbus_t35_us = (35 * BITS_PER_BYTE * 1000000 + 10 * baud_rate - 1) / (10 * baud_rate);
+    }
+}
+
+/**
+ * @brief Sets baud rate of UART and recalculates timing.
+ * 
+ * At low baud rates, FIFO is disabled so every character is timestamped. At high baud rates,
+ * characters are received through FIFO (RX timeout is negligible compared to fixed t1.5 and t3.5).
+ * @param baud_rate Requested baud rate
+ */
+void configure_modbus_uart(uint baud_rate){
+    uint actual_baud_rate = uart_set_baudrate(MODBUS_UART, baud_rate);
+    uart_set_fifo_enabled(MODBUS_UART, baud_rate > UART_FIFO_BAUD_RATE);
+    set_modbus_timing(actual_baud_rate);
+
+    rx_frames[rx_receiving_frame].length = 0;
+    rx_frames[rx_receiving_frame].corrupted = false;
+}
+
+/**
+ * @brief Interrupt handler for UART RX, fired for every received character (FIFO is disabled).
+ * 
+ * Character is appended to the frame being received and t3.5 alarm is restarted.
+ * Frame is marked as corrupted if the gap between characters exceeds t1.5.
+ */
+void __time_critical_func(modbus_uart_irq_handler)(){
+    while (uart_is_readable(MODBUS_UART)){
+        uint32_t now = time_us_32();
+        uint32_t data = uart_get_hw(MODBUS_UART)->dr;
+        modbus_rx_frame* frame = &rx_frames[rx_receiving_frame];
+
+        //Interval between ends of characters includes the character itself
+        if (frame->length > 0 && now - rx_last_char_time > modbus_char_time_us + modbus_t15_us){
+            frame->corrupted = true;
+        }
+        if (data & (UART_UARTDR_OE_BITS | UART_UARTDR_BE_BITS | UART_UARTDR_PE_BITS | UART_UARTDR_FE_BITS)){
+            frame->corrupted = true;
+        }
+
+        if (frame->length < UART_RX_BUFFER_SIZE){
+            frame->data[frame->length++] = data & 0xff;
+        }
+        else {
+            frame->corrupted = true;
+        }
+        rx_last_char_time = now;
+    }
+
+    hardware_alarm_set_target(rx_frame_alarm, delayed_by_us(get_absolute_time(), modbus_t35_us));
+}
 
+/**
+ * @brief Callback for t3.5 alarm, closes the frame being received.
+ * 
+ * If the previous frame was not processed yet, new frame is dropped
+ * (master must not send another request before response).
+ * @param alarm_num Not used
+ */
+void __time_critical_func(modbus_frame_end_callback)(__unused uint alarm_num){
+    if (rx_frames[rx_receiving_frame].length > 0 && rx_ready_frame == MODBUS_NO_FRAME){
+        rx_frames[rx_receiving_frame].end_time_us = time_us_32();
+        rx_ready_frame = rx_receiving_frame;
+        rx_receiving_frame = (rx_receiving_frame + 1) % MODBUS_RX_FRAME_NUM;
+    }
+    rx_frames[rx_receiving_frame].length = 0;
+    rx_frames[rx_receiving_frame].corrupted = false;
+}
 
 /**
  * @brief Initializes all pins and UART communication
@@ -317,44 +1113,145 @@ void init_modbus_uart(){
     gpio_set_function(MODBUS_UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(MODBUS_UART_RX_PIN, GPIO_FUNC_UART);
     uart_set_format(MODBUS_UART, UART_BIT_NUMBER, UART_STOP_BITS, UART_PARITY_EVEN);
+    configure_modbus_uart(MODBUS_UART_BAUD_RATE);
 
-    gpio_init(ONBOARD_LED_PIN);
-    gpio_set_dir(ONBOARD_LED_PIN, GPIO_OUT);
-    //gpio_pull_down(ONBOARD_LED_PIN);
+    rx_frame_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(rx_frame_alarm, modbus_frame_end_callback);
+    irq_set_exclusive_handler(MODBUS_UART_IRQ, modbus_uart_irq_handler);
+    irq_set_enabled(MODBUS_UART_IRQ, true);
+    uart_set_irq_enables(MODBUS_UART, true, false);
+
+    //Configures dma channel to send responses
+    dma_channel_uart_tx = dma_claim_unused_channel(true);
+    dma_config_uart_tx = dma_channel_get_default_config(dma_channel_uart_tx);
+    channel_config_set_transfer_data_size(&dma_config_uart_tx, DMA_SIZE_8);
+    channel_config_set_read_increment(&dma_config_uart_tx, true);
+    channel_config_set_write_increment(&dma_config_uart_tx, false);
+    channel_config_set_dreq(&dma_config_uart_tx, uart_get_dreq(MODBUS_UART, true));
+    dma_channel_configure(
+        dma_channel_uart_tx,
+        &dma_config_uart_tx,
+        &uart_get_hw(MODBUS_UART)->dr,
+        tx_buffers[0],
+        0,
+        false
+    );
+
+    //Interrupt is handled by this core (DMA IRQ 0 is used by core0)
+    dma_channel_set_irq1_enabled(dma_channel_uart_tx, true);
+    irq_set_exclusive_handler(DMA_IRQ_1, dma_irq1_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+}
+
+
+
+//Baud rate switching
+/**
+ * @brief Applies baud rate requested by host (or restores confirmed one).
+ * 
+ * Waits until the response is sent at the current baud rate. If new baud
+ * rate is not confirmed, confirmation timer is started.
+ */
+void apply_baud_rate(){
+    while (tx_sending_buffer != MODBUS_NO_FRAME){
+        __wfe();
+    }
+    uart_tx_wait_blocking(MODBUS_UART);
+
+    uint32_t interrupts = save_and_disable_interrupts();
+    configure_modbus_uart(modbus_baud_rate);
+    restore_interrupts(interrupts);
+    baud_rate_change_pending = false;
+
+    if (baud_rate_confirm_timer != -1){
+        alarm_pool_cancel_alarm(p1, baud_rate_confirm_timer);
+        baud_rate_confirm_timer = -1;
+    }
+    if (modbus_baud_rate != confirmed_baud_rate){
+        baud_rate_confirm_timer = alarm_pool_add_alarm_in_us(p1, BAUD_RATE_CONFIRM_TIMEOUT_US, baud_rate_confirm_timeout_callback, NULL, false);
+    }
+}
+
+/**
+ * @brief Confirms current baud rate, called when valid request is received.
+ */
+void confirm_baud_rate(){
+    if (baud_rate_confirm_timer != -1){
+        alarm_pool_cancel_alarm(p1, baud_rate_confirm_timer);
+        baud_rate_confirm_timer = -1;
+    }
+    confirmed_baud_rate = modbus_baud_rate;
 }
 
 
 
+
+
 void communication_loop(){
 
-    init_modbus_uart();
+    gpio_init(ONBOARD_LED_PIN);
+    gpio_set_dir(ONBOARD_LED_PIN, GPIO_OUT);
+    //gpio_pull_down(ONBOARD_LED_PIN);
 
     p1 = alarm_pool_create_with_unused_hardware_alarm(MAX_TIMERS_NUM);
+    LATENCY_INIT();
 
-    int received_bytes = 0;
     request_packet received_packet = {};
 
+#ifdef MODBUS_USB_TRANSPORT
+    //USB interrupt is handled by this core
+    usb_transport_init();
+
     while(true){
-        if (uart_is_readable_within_us(MODBUS_UART, MAX_DELAY_US)){
-            received_packet.raw_data[received_bytes++] = uart_getc(MODBUS_UART);
-            if (received_bytes > MODBUS_REQUEST_BASE_LENGTH + CRC_LEN){
-                received_bytes = 0;
+        usb_transport_task();
+
+        //Core sleeps until USB interrupt arrives, received data are signalized by tud_cdc_rx_cb
+        if (usb_rx_pending == false){
+            __wfe();
+            continue;
+        }
+        usb_rx_pending = false;
+
+        uint16_t length = 0;
+        while (usb_receive_frame(received_packet.raw_data, &length) == true){
+            request_end_time = time_us_32();
+            if (length == get_request_data_length(received_packet.raw_data, length) &&
+                received_packet.raw_data[0] == MY_ADDRESS){
+                process_request(&received_packet);
             }
         }
-        else {
-            if (received_bytes == MODBUS_REQUEST_BASE_LENGTH + CRC_LEN &&
-                received_packet.address == MY_ADDRESS &&
-                calculate_crc(received_packet.raw_data, MODBUS_REQUEST_BASE_LENGTH, false) == true){
+    }
+#else
+    init_modbus_uart();
 
-                handle_request(&received_packet);
-                if (onboard_led_timer != -1){
-                    alarm_pool_cancel_alarm(p1, onboard_led_timer);
-                }
-                gpio_put(ONBOARD_LED_PIN, 1);
-                onboard_led_timer = alarm_pool_add_alarm_in_us(p1, ONBOARD_LED_TIME_US, onboard_led_time_callback, NULL, false);
+    while(true){
+        if (baud_rate_revert_request == true){
+            baud_rate_revert_request = false;
+            modbus_baud_rate = confirmed_baud_rate;
+            apply_baud_rate();
+        }
+
+        //Core sleeps until interrupt (end of frame) arrives
+        if (rx_ready_frame == MODBUS_NO_FRAME){
+            __wfe();
+            continue;
+        }
+
+        modbus_rx_frame* frame = &rx_frames[rx_ready_frame];
+        if (frame->corrupted == false &&
+            frame->length == get_request_length(frame->data, frame->length) &&
+            frame->data[0] == MY_ADDRESS &&
+            calculate_crc(frame->data, frame->length - CRC_LEN, false) == true){
+
+            memcpy(received_packet.raw_data, frame->data, frame->length);
+            request_end_time = frame->end_time_us;
+            confirm_baud_rate();
+            process_request(&received_packet);
+            if (baud_rate_change_pending == true){
+                apply_baud_rate();
             }
-            received_bytes = 0;
         }
-       
+        rx_ready_frame = MODBUS_NO_FRAME;
     }
+#endif
 }
\ No newline at end of file
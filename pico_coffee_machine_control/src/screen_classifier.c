@@ -0,0 +1,58 @@
+#include "lib/screen_classifier.h"
+
+/**
+ * @brief Counts words of screen which do not fit the template.
+ * 
+ * @param framebuffer Decoded screen
+ * @param template Screen template
+ * @param limit Counting stops when this number of mismatches is reached
+ * @return Number of mismatching words (at most limit)
+ */
+uint16_t count_mismatches(volatile screen_framebuffer* framebuffer, const screen_template* template, uint16_t limit){
+    uint16_t mismatches = 0;
+
+    for (int i = 0; i < SCREEN_WORD_NUM && mismatches < limit; ++i){
+        uint32_t word = framebuffer->words[i];
+        if (template->type == TEMPLATE_EXACT ? word != template->words[i] : (word & template->words[i]) != template->words[i]){
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+/**
+ * @brief Checks whether the fitting template should be preferred over the current one
+ */
+bool is_preferred(const screen_template* template, const screen_template* current){
+    if (template->type != current->type){
+        return template->type == TEMPLATE_EXACT;
+    }
+    return template->weight > current->weight;
+}
+
+void classify_screen(volatile screen_framebuffer* framebuffer, bool red_screen, screen_classification* result){
+    uint16_t closest_mismatches = SCREEN_WORD_NUM;
+    memset(result, 0, sizeof(screen_classification));
+    result->screen_id = SCREEN_NO_MATCH;
+    result->red_screen = red_screen;
+
+    for (uint16_t id = 0; id < screen_template_num; ++id){
+        if (screen_templates[id].is_error != red_screen){
+            continue;
+        }
+        //No need to count further than the closest template when nothing fits yet
+        uint16_t limit = result->screen_id == SCREEN_NO_MATCH ? closest_mismatches : 1;
+        uint16_t mismatches = count_mismatches(framebuffer, &screen_templates[id], limit);
+
+        if (mismatches == 0){
+            result->match_bitmap[id / 16] |= 1u << (id % 16);
+            if (result->screen_id == SCREEN_NO_MATCH || is_preferred(&screen_templates[id], &screen_templates[result->screen_id])){
+                result->screen_id = id;
+            }
+        }
+        if (mismatches < closest_mismatches){
+            closest_mismatches = mismatches;
+        }
+    }
+    result->confidence = (SCREEN_WORD_NUM - closest_mismatches) * 100 / SCREEN_WORD_NUM;
+}
@@ -0,0 +1,31 @@
+#include "lib/screen_compression.h"
+
+uint16_t compress_screen(const uint8_t* screen, const uint8_t* base, uint8_t* output){
+    uint16_t length = 0;
+    int i = 0;
+
+    while (i < SCREEN_BYTE_NUM){
+        int run = 0;
+
+        //Unchanged bytes
+        while (i + run < SCREEN_BYTE_NUM && run < RLE_MAX_RUN_LENGTH && screen[i + run] == base[i + run]){
+            ++run;
+        }
+        if (run > 0){
+            output[length++] = RLE_ZERO_RUN | (run - 1);
+            i += run;
+            continue;
+        }
+
+        //Changed bytes, run ends with first unchanged byte
+        while (i + run < SCREEN_BYTE_NUM && run < RLE_MAX_RUN_LENGTH && screen[i + run] != base[i + run]){
+            ++run;
+        }
+        output[length++] = run - 1;
+        for (int j = 0; j < run; ++j){
+            output[length++] = screen[i + j] ^ base[i + j];
+        }
+        i += run;
+    }
+    return length;
+}
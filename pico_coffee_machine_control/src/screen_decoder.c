@@ -0,0 +1,79 @@
+#include "lib/screen_decoder.h"
+
+/**
+ * @brief Finds all page writes in SPI transmission.
+ * 
+ * @param frame Received SPI bytes
+ * @param length Number of received bytes
+ * @param writes Array for found page writes (SCREEN_MAX_PAGE_WRITES long)
+ * @return Number of page writes, -1 if transmission is malformed.
+ */
+int find_page_writes(volatile uint8_t* frame, uint16_t length, screen_page_write* writes){
+    int write_num = 0;
+    int column = -1; //Column address has not been set yet
+
+    for (int i = 0; i < length; ++i){
+        uint8_t value = frame[i] & CMD_VALUE_MASK;
+
+        switch (frame[i] & CMD_GROUP_MASK){
+            case CMD_COLUMN_ADDRESS_LOW:
+                column = ((column < 0 ? 0 : column) & 0xf0) | value;
+                break;
+
+            case CMD_COLUMN_ADDRESS_HIGH:
+                column = ((column < 0 ? 0 : column) & 0x0f) | (value << 4);
+                break;
+
+            case CMD_PAGE_ADDRESS: {
+                if (value >= SCREEN_PAGE_NUM || column < SCREEN_COLUMN_OFFSET || 
+                    column >= SCREEN_COLUMN_OFFSET + SCREEN_PAGE_WIDTH || write_num >= SCREEN_MAX_PAGE_WRITES){
+                    return -1;
+                }
+                //Data fill the rest of the page and must be complete
+                uint8_t data_length = SCREEN_PAGE_WIDTH - (column - SCREEN_COLUMN_OFFSET);
+                if (i + 1 + data_length > length){
+                    return -1;
+                }
+
+                writes[write_num].page = value;
+                writes[write_num].column = column - SCREEN_COLUMN_OFFSET;
+                writes[write_num].length = data_length;
+                writes[write_num].data_offset = i + 1;
+                ++write_num;
+
+                i += data_length;
+                column += data_length;
+                break;
+            }
+
+            default:
+                //Commands with parameter, parameter must not be taken as another command
+                if (frame[i] == CMD_ELECTRONIC_VOLUME || frame[i] == CMD_BOOSTER_RATIO){
+                    ++i;
+                }
+                break;
+        }
+    }
+    return write_num;
+}
+
+bool decode_screen_frame(volatile uint8_t* frame, uint16_t length, volatile screen_framebuffer* framebuffer, uint8_t* changed_pages){
+    screen_page_write writes[SCREEN_MAX_PAGE_WRITES];
+    int write_num = find_page_writes(frame, length, writes);
+    *changed_pages = 0;
+
+    if (write_num < 0){
+        return false;
+    }
+
+    for (int i = 0; i < write_num; ++i){
+        volatile uint8_t* target = framebuffer->pages[writes[i].page] + writes[i].column;
+        volatile uint8_t* source = frame + writes[i].data_offset;
+
+        if (memcmp((const void*)target, (const void*)source, writes[i].length) != 0){
+            memcpy((void*)target, (const void*)source, writes[i].length);
+            *changed_pages |= 1u << writes[i].page;
+        }
+    }
+    return true;
+}
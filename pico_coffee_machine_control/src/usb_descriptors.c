@@ -0,0 +1,94 @@
+#include "tusb.h"
+#include "pico/unique_id.h"
+
+//USB descriptors of USB transport (MODBUS_USB_TRANSPORT), one CDC interface
+
+#define USB_VID 0x2E8A //Raspberry Pi
+#define USB_PID 0x000A //The same as Pico SDK stdio USB, so the device is recognized by host as before
+#define USB_BCD 0x0200
+#define USB_MAX_POWER_MA 250
+
+#define USB_ITF_CDC 0
+#define USB_ITF_NUM 2 //CDC control and data interfaces
+#define USB_EP_CDC_NOTIFICATION 0x81
+#define USB_EP_CDC_OUT 0x02
+#define USB_EP_CDC_IN 0x82
+#define USB_CDC_NOTIFICATION_SIZE 8
+#define USB_CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN)
+
+#define USB_STRING_LANGUAGE 0
+#define USB_STRING_MANUFACTURER 1
+#define USB_STRING_PRODUCT 2
+#define USB_STRING_SERIAL 3
+#define USB_STRING_CDC 4
+#define USB_STRING_MAX_LEN 32
+
+static const tusb_desc_device_t usb_device_descriptor = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = USB_BCD,
+    //Interface association descriptor is used by CDC
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USB_VID,
+    .idProduct = USB_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = USB_STRING_MANUFACTURER,
+    .iProduct = USB_STRING_PRODUCT,
+    .iSerialNumber = USB_STRING_SERIAL,
+    .bNumConfigurations = 1
+};
+
+static const uint8_t usb_configuration_descriptor[USB_CONFIG_TOTAL_LEN] = {
+    TUD_CONFIG_DESCRIPTOR(1, USB_ITF_NUM, 0, USB_CONFIG_TOTAL_LEN, 0, USB_MAX_POWER_MA),
+    TUD_CDC_DESCRIPTOR(USB_ITF_CDC, USB_STRING_CDC, USB_EP_CDC_NOTIFICATION, USB_CDC_NOTIFICATION_SIZE, 
+        USB_EP_CDC_OUT, USB_EP_CDC_IN, CFG_TUD_CDC_EP_BUFSIZE)
+};
+
+static const char* usb_strings[] = {
+    [USB_STRING_MANUFACTURER] = "Raspberry Pi",
+    [USB_STRING_PRODUCT] = "Coffee machine controller",
+    [USB_STRING_CDC] = "Register protocol",
+};
+
+const uint8_t* tud_descriptor_device_cb(){
+    return (const uint8_t*)&usb_device_descriptor;
+}
+
+const uint8_t* tud_descriptor_configuration_cb(uint8_t index){
+    return usb_configuration_descriptor;
+}
+
+/**
+ * @brief Returns string descriptor (UTF-16), serial number is unique ID of board.
+ */
+const uint16_t* tud_descriptor_string_cb(uint8_t index, uint16_t langid){
+    static uint16_t descriptor[USB_STRING_MAX_LEN + 1];
+    char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    const char* string = NULL;
+    uint8_t length = 0;
+
+    if (index == USB_STRING_LANGUAGE){
+        descriptor[1] = 0x0409; //English
+        length = 1;
+    }
+    else {
+        if (index == USB_STRING_SERIAL){
+            pico_get_unique_board_id_string(serial, sizeof(serial));
+            string = serial;
+        }
+        else if (index < sizeof(usb_strings) / sizeof(usb_strings[0])){
+            string = usb_strings[index];
+        }
+        if (string == NULL){
+            return NULL;
+        }
+        for (; length < USB_STRING_MAX_LEN && string[length] != 0; ++length){
+            descriptor[1 + length] = string[length];
+        }
+    }
+    descriptor[0] = (TUSB_DESC_STRING << 8) | (2 * length + 2);
+    return descriptor;
+}
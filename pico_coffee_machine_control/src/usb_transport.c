@@ -0,0 +1,79 @@
+#include "lib/usb_transport.h"
+
+//Frame being received, starting with MBAP header
+uint8_t usb_rx_buffer[MBAP_HEADER_LEN + USB_MAX_FRAME_LEN] = {0};
+uint16_t usb_rx_length = 0;
+uint32_t usb_rx_last_time = 0;
+uint16_t usb_transaction_id = 0; //Of the last request, echoed in response
+volatile bool usb_rx_pending = false; //Set when new data are received
+
+/**
+ * @brief TinyUSB callback, called from tud_task when data are received.
+ * 
+ * @param itf Not used
+ */
+void tud_cdc_rx_cb(uint8_t itf){
+    usb_rx_pending = true;
+}
+
+void usb_transport_init(){
+    tusb_init();
+}
+
+void usb_transport_task(){
+    tud_task();
+}
+
+bool usb_receive_frame(uint8_t* data, uint16_t* length){
+    if (usb_rx_length > 0 && time_us_32() - usb_rx_last_time > USB_FRAME_TIMEOUT_US){
+        usb_rx_length = 0;
+    }
+
+    while (tud_cdc_available() > 0){
+        //Header is read first, then exactly the rest of frame, so the next frame stays in USB buffer
+        uint16_t frame_length = MBAP_HEADER_LEN;
+        if (usb_rx_length >= MBAP_HEADER_LEN){
+            frame_length += (usb_rx_buffer[4] << 8) | usb_rx_buffer[5];
+        }
+        usb_rx_length += tud_cdc_read(usb_rx_buffer + usb_rx_length, frame_length - usb_rx_length);
+        usb_rx_last_time = time_us_32();
+
+        if (usb_rx_length == MBAP_HEADER_LEN){
+            uint16_t protocol_id = (usb_rx_buffer[2] << 8) | usb_rx_buffer[3];
+            uint16_t pdu_length = (usb_rx_buffer[4] << 8) | usb_rx_buffer[5];
+            //Stream is resynchronized by dropping invalid header
+            if (protocol_id != 0 || pdu_length < 2 || pdu_length > USB_MAX_FRAME_LEN){
+                usb_rx_length = 0;
+            }
+        }
+        else if (usb_rx_length == frame_length){
+            usb_transaction_id = (usb_rx_buffer[0] << 8) | usb_rx_buffer[1];
+            *length = usb_rx_length - MBAP_HEADER_LEN;
+            memcpy(data, usb_rx_buffer + MBAP_HEADER_LEN, *length);
+            usb_rx_length = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+void usb_send_frame(const volatile uint8_t* data, uint16_t length){
+    uint8_t frame[MBAP_HEADER_LEN + USB_MAX_FRAME_LEN];
+    frame[0] = usb_transaction_id >> 8;
+    frame[1] = usb_transaction_id & 0xff;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = length >> 8;
+    frame[5] = length & 0xff;
+    memcpy(frame + MBAP_HEADER_LEN, (const void*)data, length);
+
+    //Frame fits into TX FIFO unless the host stopped reading, then it waits until space is available
+    uint16_t sent = 0;
+    while (sent < MBAP_HEADER_LEN + length && tud_mounted()){
+        sent += tud_cdc_write(frame + sent, MBAP_HEADER_LEN + length - sent);
+        tud_cdc_write_flush();
+        if (sent < MBAP_HEADER_LEN + length){
+            tud_task();
+        }
+    }
+}
@@ -0,0 +1,67 @@
+"""Generates src/screen_templates.c (flash-resident screen templates) from the
+screen record database of the RPI4 controller.
+
+Usage: python3 tools/generate_screen_templates.py [path/to/Database.json]
+"""
+import json
+import os
+import sys
+
+PAGE_NUM = 8
+PAGE_WIDTH = 128
+MAX_TEMPLATE_NUM = 64 #Limited by size of match bitmap (4 registers)
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+DEFAULT_DATABASE = os.path.join(ROOT, "..", "rpi4_coffee_machine_controller", "Database.json")
+OUTPUT = os.path.join(ROOT, "src", "screen_templates.c")
+
+
+def record_to_bytes(record):
+    """Converts graphic form of record into screen bytes (same as DatabaseRecord.ImportFromString)."""
+    lines = record["ScreenRecordGraphicArray"]
+    screen = bytearray(PAGE_NUM * PAGE_WIDTH)
+    for page in range(PAGE_NUM):
+        for bit in range(8):
+            line = lines[page * 8 + bit]
+            for column in range(PAGE_WIDTH):
+                if line[column] == '0':
+                    screen[page * PAGE_WIDTH + column] |= 1 << bit
+                elif line[column] != '.':
+                    raise ValueError(f"Invalid character in record {record['Id']}")
+    return screen
+
+
+def main():
+    database = sys.argv[1] if len(sys.argv) > 1 else DEFAULT_DATABASE
+    with open(database) as f:
+        records = json.load(f)
+    if len(records) > MAX_TEMPLATE_NUM:
+        raise ValueError(f"Too many records ({len(records)}), at most {MAX_TEMPLATE_NUM} are supported")
+
+    out = []
+    out.append("//Generated by tools/generate_screen_templates.py from Database.json, do not edit.")
+    out.append('#include "lib/screen_classifier.h"')
+    out.append("")
+    out.append(f"const uint16_t screen_template_num = {len(records)};")
+    out.append("")
+    out.append("const screen_template screen_templates[] = {")
+    for index, record in enumerate(records):
+        screen = record_to_bytes(record)
+        words = [int.from_bytes(screen[i:i + 4], "little") for i in range(0, len(screen), 4)]
+        weight = sum(bin(b).count("1") for b in screen)
+        kind = "TEMPLATE_MASK" if record["IsMask"] else "TEMPLATE_EXACT"
+        error = "true" if record["IsError"] else "false"
+        out.append(f"    //{index}: {record['Id']}")
+        out.append(f"    {{.type = {kind}, .is_error = {error}, .weight = {weight}, .words = {{")
+        for i in range(0, len(words), 8):
+            out.append("        " + ", ".join(f"0x{w:08X}" for w in words[i:i + 8]) + ",")
+        out.append("    }},")
+    out.append("};")
+    out.append("")
+
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
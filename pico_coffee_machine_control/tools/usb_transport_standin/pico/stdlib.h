@@ -0,0 +1,15 @@
+#ifndef STANDIN_PICO_STDLIB
+#define STANDIN_PICO_STDLIB
+
+//Subset of Pico SDK used by usb_transport.c, implemented for Linux
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+static inline uint32_t time_us_32(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000000ull + now.tv_nsec / 1000);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef STANDIN_TUSB
+#define STANDIN_TUSB
+
+//TinyUSB CDC device API used by usb_transport.c, backed by pseudo terminal in stand-in
+#include <stdint.h>
+#include <stdbool.h>
+
+bool tusb_init();
+void tud_task();
+bool tud_mounted();
+uint32_t tud_cdc_available();
+uint32_t tud_cdc_read(void* buffer, uint32_t bufsize);
+uint32_t tud_cdc_write(const void* buffer, uint32_t bufsize);
+uint32_t tud_cdc_write_flush();
+
+//Implemented by usb_transport.c
+void tud_cdc_rx_cb(uint8_t itf);
+
+#endif
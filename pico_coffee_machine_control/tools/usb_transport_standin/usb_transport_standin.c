@@ -0,0 +1,237 @@
+/*Linux stand-in for USB CDC transport of the register protocol. The same usb_transport.c as in firmware
+is compiled against TinyUSB CDC API backed by pseudo terminal, so the host (PicoController with
+usbTransport) can be tested without Pico. Waiting for USB interrupt is replaced by poll of the terminal.
+Register map is simplified: holding registers keep written values, input register n reads as n.
+
+Build (from pico_coffee_machine_control):
+    gcc -I tools/usb_transport_standin -I . tools/usb_transport_standin/usb_transport_standin.c src/usb_transport.c -o usb_transport_standin
+Run ./usb_transport_standin, it prints path of the terminal which is then opened by host.
+*/
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include "lib/usb_transport.h"
+
+#define MY_ADDRESS 2
+#define FC_READ_HOLDING_REGISTERS 3
+#define FC_READ_INPUT_REGISTERS 4
+#define FC_WRITE_SINGLE_REGISTER 6
+#define FC_WRITE_MULTIPLE_REGISTERS 16
+#define FC_READ_WRITE_MULTIPLE_REGISTERS 23
+#define EX_ILLEGAL_FUNCTION 1
+#define EX_ILLEGAL_ADDRESS 2
+#define EX_ILLEGAL_VALUE 3
+#define MAX_READ_REGISTER_NUM 125
+#define MAX_WRITE_REGISTER_NUM 123
+#define MAX_READ_WRITE_REGISTER_NUM 121
+#define REGISTER_NUM 0x10000
+
+#define RX_FIFO_SIZE 512 //CFG_TUD_CDC_RX_BUFSIZE of firmware
+
+int pty_master = -1;
+uint16_t holding_registers[REGISTER_NUM] = {0};
+uint8_t rx_fifo[RX_FIFO_SIZE];
+uint32_t rx_fifo_length = 0;
+
+bool tusb_init(){
+    return true;
+}
+
+/**
+ * @brief Moves data from terminal to RX FIFO and signalizes them by tud_cdc_rx_cb, as TinyUSB does.
+ */
+void tud_task(){
+    int received = read(pty_master, rx_fifo + rx_fifo_length, RX_FIFO_SIZE - rx_fifo_length);
+    //No data, or host has not opened the terminal yet
+    if (received > 0){
+        rx_fifo_length += received;
+        tud_cdc_rx_cb(0);
+    }
+}
+
+bool tud_mounted(){
+    return true;
+}
+
+uint32_t tud_cdc_available(){
+    return rx_fifo_length;
+}
+
+uint32_t tud_cdc_read(void* buffer, uint32_t bufsize){
+    uint32_t length = bufsize < rx_fifo_length ? bufsize : rx_fifo_length;
+    memcpy(buffer, rx_fifo, length);
+    memmove(rx_fifo, rx_fifo + length, rx_fifo_length - length);
+    rx_fifo_length -= length;
+    return length;
+}
+
+uint32_t tud_cdc_write(const void* buffer, uint32_t bufsize){
+    const uint8_t* data = buffer;
+    uint32_t remaining = bufsize;
+    while (remaining > 0){
+        int written = write(pty_master, data, remaining);
+        if (written < 0){
+            if (errno == EAGAIN){
+                continue;
+            }
+            perror("write");
+            exit(1);
+        }
+        data += written;
+        remaining -= written;
+    }
+    return bufsize;
+}
+
+uint32_t tud_cdc_write_flush(){
+    return 0;
+}
+
+uint16_t get_16bit(const uint8_t* data){
+    return (data[0] << 8) | data[1];
+}
+
+void put_16bit(uint8_t* data, uint16_t value){
+    data[0] = value >> 8;
+    data[1] = value & 0xff;
+}
+
+/**
+ * @brief Fills response with read registers.
+ * 
+ * @return Length of response
+ */
+uint16_t read_registers(uint8_t* response, uint8_t function_code, uint16_t first_register, uint16_t register_count){
+    response[1] = function_code;
+    response[2] = register_count * 2;
+    for (int i = 0; i < register_count; ++i){
+        uint16_t address = first_register + i;
+        put_16bit(response + 3 + i * 2, function_code == FC_READ_HOLDING_REGISTERS ? holding_registers[address] : address);
+    }
+    return 3 + register_count * 2;
+}
+
+/**
+ * @brief Handles request (unit ID and PDU) and builds response.
+ * 
+ * @return Length of response
+ */
+uint16_t handle_request(const uint8_t* request, uint16_t length, uint8_t* response){
+    uint8_t function_code = request[1];
+    uint16_t first_register = get_16bit(request + 2);
+    uint16_t register_count = get_16bit(request + 4);
+    uint8_t error_code = 0;
+    response[0] = request[0];
+
+    switch (function_code){
+        case FC_READ_HOLDING_REGISTERS:
+        case FC_READ_INPUT_REGISTERS:
+            if (length != 6 || register_count == 0 || register_count > MAX_READ_REGISTER_NUM || 
+                first_register + register_count > REGISTER_NUM){
+                error_code = EX_ILLEGAL_ADDRESS;
+                break;
+            }
+            return read_registers(response, function_code, first_register, register_count);
+
+        case FC_WRITE_SINGLE_REGISTER:
+            if (length != 6){
+                error_code = EX_ILLEGAL_VALUE;
+                break;
+            }
+            holding_registers[first_register] = register_count;
+            memcpy(response, request, 6);
+            return 6;
+
+        case FC_WRITE_MULTIPLE_REGISTERS:
+            if (register_count == 0 || register_count > MAX_WRITE_REGISTER_NUM || length != 7 + register_count * 2 ||
+                request[6] != register_count * 2 || first_register + register_count > REGISTER_NUM){
+                error_code = EX_ILLEGAL_VALUE;
+                break;
+            }
+            for (int i = 0; i < register_count; ++i){
+                holding_registers[first_register + i] = get_16bit(request + 7 + i * 2);
+            }
+            memcpy(response, request, 6);
+            return 6;
+
+        case FC_READ_WRITE_MULTIPLE_REGISTERS: {
+            uint16_t write_first_register = get_16bit(request + 6);
+            uint16_t write_register_count = get_16bit(request + 8);
+            if (register_count == 0 || register_count > MAX_READ_REGISTER_NUM || first_register + register_count > REGISTER_NUM ||
+                write_register_count == 0 || write_register_count > MAX_READ_WRITE_REGISTER_NUM || 
+                length != 11 + write_register_count * 2 || write_first_register + write_register_count > REGISTER_NUM){
+                error_code = EX_ILLEGAL_VALUE;
+                break;
+            }
+            for (int i = 0; i < write_register_count; ++i){
+                holding_registers[write_first_register + i] = get_16bit(request + 11 + i * 2);
+            }
+            //Input registers are read (as by firmware)
+            return read_registers(response, FC_READ_INPUT_REGISTERS, first_register, register_count);
+        }
+
+        default:
+            error_code = EX_ILLEGAL_FUNCTION;
+            break;
+    }
+    response[1] = function_code | 0b10000000;
+    response[2] = error_code;
+    return 3;
+}
+
+/**
+ * @brief Opens pseudo terminal in raw mode, slave side stays open so the master does not fail when host disconnects.
+ */
+void open_pty(){
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_master < 0 || grantpt(pty_master) != 0 || unlockpt(pty_master) != 0){
+        perror("posix_openpt");
+        exit(1);
+    }
+    char* slave_name = ptsname(pty_master);
+    int pty_slave = open(slave_name, O_RDWR | O_NOCTTY);
+    if (pty_slave < 0){
+        perror("open");
+        exit(1);
+    }
+    struct termios attributes;
+    tcgetattr(pty_slave, &attributes);
+    cfmakeraw(&attributes);
+    tcsetattr(pty_slave, TCSANOW, &attributes);
+    fcntl(pty_master, F_SETFL, O_NONBLOCK);
+
+    printf("%s\n", slave_name);
+    fflush(stdout);
+}
+
+int main(){
+    open_pty();
+    usb_transport_init();
+
+    uint8_t request[USB_MAX_FRAME_LEN];
+    uint8_t response[USB_MAX_FRAME_LEN];
+    while (true){
+        usb_transport_task();
+
+        //Sleeps until data arrive (core1 sleeps in __wfe until USB interrupt)
+        if (usb_rx_pending == false){
+            struct pollfd terminal = {.fd = pty_master, .events = POLLIN};
+            poll(&terminal, 1, -1);
+            continue;
+        }
+        usb_rx_pending = false;
+
+        uint16_t length = 0;
+        while (usb_receive_frame(request, &length) == true){
+            if (request[0] == MY_ADDRESS){
+                usb_send_frame(response, handle_request(request, length, response));
+            }
+        }
+    }
+}
@@ -5,6 +5,7 @@
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/spi.h"
+#include "lib/modbus_crc.h"
 
 #define MODBUS_UART uart0
 #define MODBUS_UART_BAUD_RATE 115200
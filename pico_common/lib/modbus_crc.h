@@ -0,0 +1,23 @@
+#ifndef MODBUS_CRC
+#define MODBUS_CRC
+
+#include <stdint.h>
+
+/*Modbus CRC-16 (polynomial 0xA001 reflected, initial value 0xFFFF), shared by controller and emulator.
+CRC is calculated by slicing-by-4 tables, 4 bytes are processed per iteration.
+(DMA sniffer of RP2040 supports only CRC-32 and CRC-16-CCITT, so it can't be used for Modbus.)
+Host test and benchmark are in tools/modbus_crc_test (cmake -S tools/modbus_crc_test -B build && ctest --test-dir build).
+*/
+
+#define MODBUS_CRC_INIT 0xFFFF
+
+/**
+ * @brief Calculates Modbus CRC of data.
+ * 
+ * @param data Data buffer
+ * @param length Length of buffer (in bytes)
+ * @return CRC of data
+ */
+uint16_t modbus_crc(const volatile uint8_t* data, uint16_t length);
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "lib/modbus_crc.h"
+
+#define BENCHMARK_LENGTH 219    //Response with 107 registers (register group)
+#define BENCHMARK_ITERATIONS 1000000
+#define BENCHMARK_SEED 19
+
+static uint16_t crc_table[256];
+
+/**
+ * @brief Former calculate_crc of modbus_server.c and modbus_master.c (byte-at-a-time table loop).
+ */
+uint16_t byte_table_crc(volatile uint8_t* packet_data, uint16_t length)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t xor = 0;
+
+	for (int i = 0; i < length; ++i)
+	{
+		xor = packet_data[i] ^ crc;
+		crc >>= 8;
+		crc ^= crc_table[xor];
+	}
+	return crc;
+}
+
+/**
+ * @brief Returns monotonic time in nanoseconds.
+ */
+uint64_t time_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int main()
+{
+	volatile uint8_t buffer[BENCHMARK_LENGTH];
+	volatile uint16_t sink = 0; //Keeps results alive
+
+	for (int i = 0; i < 256; ++i)
+	{
+		uint16_t crc = i;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+		}
+		crc_table[i] = crc;
+	}
+	srand(BENCHMARK_SEED);
+	for (int i = 0; i < BENCHMARK_LENGTH; ++i)
+	{
+		buffer[i] = rand();
+	}
+	if (byte_table_crc(buffer, BENCHMARK_LENGTH) != modbus_crc(buffer, BENCHMARK_LENGTH))
+	{
+		printf("CRC mismatch\n");
+		return 1;
+	}
+
+	uint64_t start = time_ns();
+	for (int i = 0; i < BENCHMARK_ITERATIONS; ++i)
+	{
+		sink ^= byte_table_crc(buffer, BENCHMARK_LENGTH);
+	}
+	uint64_t byte_time = time_ns() - start;
+
+	start = time_ns();
+	for (int i = 0; i < BENCHMARK_ITERATIONS; ++i)
+	{
+		sink ^= modbus_crc(buffer, BENCHMARK_LENGTH);
+	}
+	uint64_t slicing_time = time_ns() - start;
+
+	printf("%d bytes, %d iterations\n", BENCHMARK_LENGTH, BENCHMARK_ITERATIONS);
+	printf("byte-at-a-time: %.1f ns per buffer\n", (double)byte_time / BENCHMARK_ITERATIONS);
+	printf("slicing-by-4:   %.1f ns per buffer\n", (double)slicing_time / BENCHMARK_ITERATIONS);
+	printf("speedup:        %.2fx\n", (double)byte_time / slicing_time);
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "lib/modbus_crc.h"
+
+#define TEST_MAX_LENGTH 300
+#define TEST_MAX_OFFSET 4   //Unaligned starts of buffer
+#define TEST_ITERATIONS 100000
+#define TEST_SEED 19
+
+static uint16_t byte_table[256];
+
+/**
+ * @brief Calculates Modbus CRC bit by bit (reference implementation).
+ */
+uint16_t bitwise_crc(const uint8_t* data, uint16_t length)
+{
+	uint16_t crc = MODBUS_CRC_INIT;
+	for (int i = 0; i < length; ++i)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+/**
+ * @brief Fills table of CRC for every byte value (initial value 0).
+ */
+void build_byte_table(uint16_t* table)
+{
+	for (int i = 0; i < 256; ++i)
+	{
+		uint16_t crc = i;
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+		}
+		table[i] = crc;
+	}
+}
+
+/**
+ * @brief Calculates Modbus CRC by one table lookup per byte.
+ */
+uint16_t byte_table_crc(const uint8_t* data, uint16_t length)
+{
+	uint16_t crc = MODBUS_CRC_INIT;
+	for (int i = 0; i < length; ++i)
+	{
+		crc = (crc >> 8) ^ byte_table[(data[i] ^ crc) & 0xff];
+	}
+	return crc;
+}
+
+/**
+ * @brief Checks CRC of single buffer against both references.
+ * 
+ * @return True if all CRCs match
+ */
+bool check_buffer(const uint8_t* data, uint16_t length, int offset)
+{
+	uint16_t expected = bitwise_crc(data, length);
+	uint16_t by_table = byte_table_crc(data, length);
+	uint16_t actual = modbus_crc(data, length);
+	if (actual != expected || by_table != expected)
+	{
+		printf("Mismatch (length %u, offset %d): expected 0x%04X, table 0x%04X, modbus_crc 0x%04X\n", 
+			length, offset, expected, by_table, actual);
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	uint8_t buffer[TEST_MAX_LENGTH + TEST_MAX_OFFSET];
+	int failures = 0;
+
+	build_byte_table(byte_table);
+
+	//Known vector: read of 1 input register (address 2, register 0)
+	const uint8_t request[] = {0x02, 0x04, 0x00, 0x00, 0x00, 0x01};
+	if (modbus_crc(request, sizeof(request)) != 0xF931)
+	{
+		printf("Known vector failed: 0x%04X\n", modbus_crc(request, sizeof(request)));
+		++failures;
+	}
+
+	srand(TEST_SEED);
+	for (int iteration = 0; iteration < TEST_ITERATIONS; ++iteration)
+	{
+		uint16_t length = rand() % (TEST_MAX_LENGTH + 1);
+		int offset = rand() % TEST_MAX_OFFSET;
+		for (int i = 0; i < length; ++i)
+		{
+			buffer[offset + i] = rand();
+		}
+		if (check_buffer(buffer + offset, length, offset) == false)
+		{
+			++failures;
+		}
+	}
+
+	printf("%d iterations, %d failures\n", TEST_ITERATIONS, failures);
+	return failures == 0 ? 0 : 1;
+}
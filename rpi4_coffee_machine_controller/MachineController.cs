@@ -220,11 +220,14 @@ namespace CoffeMachineController
         /// <param name="errorOutput">
         /// Path to error log file
         /// </param>
+        /// <param name="fastBaudRate">
+        /// Switch serial line to higher baud rate after each reset of pico
+        /// </param>
         /// </summary>
-        public MachineController(string portName, string database, string errorOutput)
+        public MachineController(string portName, string database, string errorOutput, bool fastBaudRate = false)
         {
             MyLogger = new(errorOutput);
-            pico = new(portName, MyLogger);
+            pico = new(portName, MyLogger, fastBaudRate: fastBaudRate);
             pico.ImportDatabase(database);
 
             pins = new();
@@ -1028,6 +1031,7 @@ namespace CoffeMachineController
             Thread.Sleep(500);
             pins.Write(RESET_PIN, PinValue.High);
             Thread.Sleep(1500);
+            pico.NegotiateBaudRate();
         }
 
         /// <summary>
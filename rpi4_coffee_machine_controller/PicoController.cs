@@ -28,8 +28,14 @@ namespace CoffeMachineController
         //Serial line properties
         private const byte DEVICE_ADDRESS = 2;
         private const int BAUD_RATE = 115200;
+        private const int FAST_BAUD_RATE = 1000000; //Negotiated by NegotiateBaudRate if enabled, BAUD_RATE is used if it fails
+        private const int BAUD_RATE_REGISTER_UNIT = 100;
+        private const int BAUD_RATE_SWITCH_DELAY = 10; //In miliseconds, time for pico to switch baud rate
+        private const int BAUD_RATE_CONFIRM_ATTEMPTS = 3; //Must fit into BAUD_RATE_CONFIRM_TIMEOUT_MS of Pico
         private const int PORT_TIMEOUT = 100; //In miliseconds
         private SerialPort port;
+        private bool usbTransport;
+        private bool fastBaudRate;
         
         //Modbus properties
         private ModbusFactory factory;
@@ -54,6 +60,11 @@ namespace CoffeMachineController
         /// </summary>
         private DisplayRecord currentScreen = new();
 
+        /// <summary>
+        /// Hash of the screen frame stored in currentScreen (reported by pico).
+        /// </summary>
+        private uint currentScreenHash = 0;
+
 
 
 
@@ -174,7 +185,10 @@ namespace CoffeMachineController
         /// </summary>
         /// <param name="portName">Serial port address</param>
         /// <param name="myLogger">Logger object</param>
-        public PicoController(string portName, EventLogger myLogger)
+        /// <param name="usbTransport">True if Pico is connected by USB (firmware built with MODBUS_USB_TRANSPORT),
+        /// requests are then framed by MBAP header instead of ModbusRTU</param>
+        /// <param name="fastBaudRate">True if NegotiateBaudRate should switch serial line to FAST_BAUD_RATE</param>
+        public PicoController(string portName, EventLogger myLogger, bool usbTransport = false, bool fastBaudRate = false)
         {
             port = new()
             {
@@ -187,12 +201,94 @@ namespace CoffeMachineController
             port.Open();
 
             factory = new();
-            conn = factory.CreateRtuMaster(port);
+            if (usbTransport == true)
+            {
+                conn = factory.CreateIpMaster(factory.CreateIpTransport(new SerialPortAdapter(port)));
+            }
+            else
+            {
+                conn = factory.CreateRtuMaster(port);
+            }
             conn.Transport.ReadTimeout = PORT_TIMEOUT;
             conn.Transport.WriteTimeout = PORT_TIMEOUT;
 
             pico = new();
             this.myLogger = myLogger;
+            this.usbTransport = usbTransport;
+            this.fastBaudRate = fastBaudRate;
+        }
+
+        /// <summary>
+        /// Negotiates baud rate with freshly reset Pico, which always starts at BAUD_RATE.
+        /// Serial line is switched to FAST_BAUD_RATE only if enabled in constructor.
+        /// </summary>
+        /// <returns>True if serial line runs at FAST_BAUD_RATE, false otherwise.</returns>
+        public bool NegotiateBaudRate()
+        {
+            port.BaudRate = BAUD_RATE;
+            //Baud rate of USB is not related to the transfer speed
+            if (usbTransport == true || fastBaudRate == false)
+            {
+                return false;
+            }
+            return SwitchBaudRate(FAST_BAUD_RATE);
+        }
+
+        /// <summary>
+        /// Switches baud rate of serial line. Pico reverts the baud rate 
+        /// if no valid request is received at the new one, so the line stays usable.
+        /// If confirmation fails, host waits until Pico reverts before it returns to the old baud rate.
+        /// </summary>
+        /// <param name="baudRate">New baud rate</param>
+        /// <returns>True if baud rate was switched, false otherwise.</returns>
+        public bool SwitchBaudRate(int baudRate)
+        {
+            int oldBaudRate = port.BaudRate;
+            try
+            {
+                conn.WriteSingleRegister(DEVICE_ADDRESS, PicoRegisters.BAUD_RATE_REGISTER_ADDRESS, (ushort)(baudRate / BAUD_RATE_REGISTER_UNIT));
+            }
+            catch (SlaveException)
+            {
+                //Baud rate was rejected, Pico stays at the old one
+                myLogger.LogEvent(new PicoErrorException(pico, $"Switching baud rate to {baudRate} failed!"));
+                return false;
+            }
+            catch (Exception ex) when (ex is TimeoutException || ex is IOException)
+            {
+                //Pico may have switched anyway
+                RevertBaudRate(oldBaudRate);
+                myLogger.LogEvent(new PicoErrorException(pico, $"Switching baud rate to {baudRate} failed!"));
+                return false;
+            }
+
+            Thread.Sleep(BAUD_RATE_SWITCH_DELAY);
+            port.BaudRate = baudRate;
+            //Confirms new baud rate
+            for (int attempt = 0; attempt < BAUD_RATE_CONFIRM_ATTEMPTS; ++attempt)
+            {
+                try
+                {
+                    ReadMachineStatus();
+                    return true;
+                }
+                catch (Exception ex) when (ex is TimeoutException || ex is IOException || ex is SlaveException)
+                {
+                }
+            }
+            RevertBaudRate(oldBaudRate);
+            myLogger.LogEvent(new PicoErrorException(pico, $"Switching baud rate to {baudRate} failed!"));
+            return false;
+        }
+
+        /// <summary>
+        /// Returns to the old baud rate after Pico reverted it (its confirm timeout elapsed).
+        /// </summary>
+        /// <param name="oldBaudRate">Baud rate used before switching</param>
+        private void RevertBaudRate(int oldBaudRate)
+        {
+            Thread.Sleep(PicoRegisters.BAUD_RATE_CONFIRM_TIMEOUT_MS + BAUD_RATE_SWITCH_DELAY);
+            port.BaudRate = oldBaudRate;
         }
 
 
@@ -235,13 +331,35 @@ namespace CoffeMachineController
                 throw new PicoErrorException(pico, "Register reading failed!"); 
             }
 
-            ushort[][] RxBuffer = new ushort[PicoRegisters.TRANSACTION_NUM][];
-            for (int i = 0; i < PicoRegisters.TRANSACTION_NUM; ++i)
+            //Screen data are transferred only if the frame changed since the last reading
+            uint frameHash = ReadFrameHash();
+            if (frameHash == currentScreenHash)
+            {
+                return;
+            }
+
+            //Frame is read in maximal windows, all of them come from the snapshot pinned by reading of status
+            int windowNum = (PicoRegisters.SPI_RAW_REGISTER_NUM + PicoRegisters.MAX_READ_REGISTER_NUM - 1) / PicoRegisters.MAX_READ_REGISTER_NUM;
+            ushort[][] RxBuffer = new ushort[windowNum][];
+            for (int i = 0; i < windowNum; ++i)
             {
-                RxBuffer[i] = conn.ReadInputRegisters(DEVICE_ADDRESS, pico.REGISTER_GROUPS[i], PicoRegisters.REGISTER_NUM);
+                int offset = i * PicoRegisters.MAX_READ_REGISTER_NUM;
+                ushort count = (ushort)Math.Min(PicoRegisters.MAX_READ_REGISTER_NUM, PicoRegisters.SPI_RAW_REGISTER_NUM - offset);
+                RxBuffer[i] = conn.ReadInputRegisters(DEVICE_ADDRESS, (ushort)(PicoRegisters.SPI_RAW_REGISTER_ADDRESS + offset), count);
             }
             pico.SpiBuffer.ParseReceivedData(RxBuffer);
             currentScreen.UpdateRecord(pico.SpiBuffer.GetScreenData());
+            currentScreenHash = frameHash;
+        }
+
+        /// <summary>
+        /// Reads hash of the screen frame pinned by the last status reading from Pico
+        /// </summary>
+        /// <returns>Frame hash</returns>
+        private uint ReadFrameHash()
+        {
+            ushort[] hashRegisters = conn.ReadInputRegisters(DEVICE_ADDRESS, PicoRegisters.FRAME_HASH_REGISTER_ADDRESS, 2);
+            return ((uint)hashRegisters[0] << 16) | hashRegisters[1];
         }
 
         /// <summary>
@@ -608,6 +726,47 @@ namespace CoffeMachineController
         }
 
 
+        /// <summary>
+        /// Uploads macro into Pico, runs it and waits until it ends.
+        /// </summary>
+        /// <param name="steps">Steps of macro</param>
+        /// <param name="timeout">Max time allowed for macro (in ms)</param>
+        /// <returns>True if all steps were completed, false otherwise.</returns>
+        /// <exception cref="ButtonPushedManuallyException">If the button was pushed by user.</exception>
+        /// <exception cref="PicoErrorException">If Pico reports error.</exception>
+        public bool RunMacro(PicoRegisters.MacroStep[] steps, long timeout)
+        {
+            if (steps.Length == 0 || steps.Length > PicoRegisters.MACRO_MAX_STEP_NUM)
+            {
+                return false;
+            }
+
+            //Writing number of steps into control register starts the macro
+            List<ushort> registers = [];
+            foreach (PicoRegisters.MacroStep step in steps)
+            {
+                registers.AddRange(step.ToRegisters());
+            }
+            ushort controlAddress = PicoRegisters.MACRO_STEP_REGISTER_ADDRESS + PicoRegisters.MACRO_MAX_STEP_NUM * PicoRegisters.MACRO_STEP_REGISTER_NUM;
+            conn.WriteMultipleRegisters(DEVICE_ADDRESS, PicoRegisters.MACRO_STEP_REGISTER_ADDRESS, registers.ToArray());
+            conn.WriteSingleRegister(DEVICE_ADDRESS, controlAddress, (ushort)steps.Length);
+
+            for (long t = 0; t < timeout; t += READ_BUTTON_DELAY)
+            {
+                Thread.Sleep(READ_BUTTON_DELAY);
+                ReadMachineStatus();
+                PicoRegisters.MacroStates state = (PicoRegisters.MacroStates)conn.ReadInputRegisters(DEVICE_ADDRESS, PicoRegisters.MACRO_STATE_REGISTER_ADDRESS, 1)[0];
+                if (state != PicoRegisters.MacroStates.Running)
+                {
+                    return state == PicoRegisters.MacroStates.Done;
+                }
+            }
+
+            //Abort
+            conn.WriteSingleRegister(DEVICE_ADDRESS, controlAddress, 0);
+            return false;
+        }
+
         /// <summary>
         /// Turn on the machine.
         /// </summary>
@@ -3,10 +3,20 @@ namespace CoffeMachineController{
     public class PicoRegisters{
         //Adresses and constants
         public const ushort INPUT_REGISTER_ADDRESS = 0;
+        public const ushort FRAME_HASH_REGISTER_ADDRESS = 2;
         public const ushort HOLDING_REGISTER_ADDRESS = 0;
+        public const ushort BAUD_RATE_REGISTER_ADDRESS = 2;
+        public const int BAUD_RATE_CONFIRM_TIMEOUT_MS = 1000; //BAUD_RATE_CONFIRM_TIMEOUT_US of Pico
         public const ushort TRANSACTION_NUM = 5;
         public const ushort REGISTER_NUM = 107;
         public readonly ushort[] REGISTER_GROUPS = [1000, 2000, 3000, 4000, 5000];
+        public const ushort SPI_RAW_REGISTER_ADDRESS = 10000;
+        public const int SPI_RAW_REGISTER_NUM = 532;
+        public const int MAX_READ_REGISTER_NUM = 125;
+        public const ushort MACRO_STATE_REGISTER_ADDRESS = 14;
+        public const ushort MACRO_STEP_REGISTER_ADDRESS = 100;
+        public const int MACRO_STEP_REGISTER_NUM = 6;
+        public const int MACRO_MAX_STEP_NUM = 16;
 
         /// <summary>
         /// Buttons on machine control panel
@@ -43,6 +53,52 @@ namespace CoffeMachineController{
             buttonClearDisable = 10,
         }
 
+        /// <summary>
+        /// Conditions of macro step
+        /// </summary>
+        public enum MacroConditions : byte
+        {
+            None = 0,
+            FrameChanged = 1,
+            PagesChanged = 2,
+            ScreenId = 3,
+            FrameHash = 4
+        }
+
+        /// <summary>
+        /// States of macro reported by pico
+        /// </summary>
+        public enum MacroStates : ushort
+        {
+            Idle = 0,
+            Running = 1,
+            Done = 2,
+            Failed = 3,
+            Aborted = 4
+        }
+
+        /// <summary>
+        /// Step of macro executed by pico: push buttons, then wait until condition is met.
+        /// If it is not met until timeout, step is repeated.
+        /// </summary>
+        /// <param name="Command">Value of command register during push</param>
+        /// <param name="PushMs">Push duration in miliseconds</param>
+        /// <param name="Condition">Condition of step</param>
+        /// <param name="RepeatNum">Number of repeated pushes</param>
+        /// <param name="TimeoutMs">Max time for condition to be met, in miliseconds</param>
+        /// <param name="Parameter">Parameter of condition</param>
+        public record MacroStep(ushort Command, ushort PushMs, MacroConditions Condition, byte RepeatNum, ushort TimeoutMs, uint Parameter = 0)
+        {
+            /// <summary>
+            /// Converts step into holding registers
+            /// </summary>
+            /// <returns>Register values</returns>
+            public ushort[] ToRegisters()
+            {
+                return [Command, PushMs, (ushort)((RepeatNum << 8) | (byte)Condition), TimeoutMs, (ushort)(Parameter & 0xffff), (ushort)(Parameter >> 16)];
+            }
+        }
+
         /// <summary>
         /// Input register
         /// </summary>